@@ -37,28 +37,34 @@ class aabb {
     }
 
     bool hit(const ray& r, interval ray_t) const {
+        // Slab test with the ray's cached reciprocal direction. Every select below is a
+        // single min or max instruction, and all three axes are always tested, so there are
+        // no branches to mispredict. A NaN slab distance (a ray parallel to the slab and
+        // starting on its plane) selects the same operand as the packet test does.
         const point3& ray_orig = r.origin();
-        const vec3&   ray_dir  = r.direction();
+        const auto& inv_dir = r.inv_direction();
 
         for (int axis = 0; axis < 3; axis++) {
             const interval& ax = axis_interval(axis);
-            const double adinv = 1.0 / ray_dir[axis];
 
-            auto t0 = (ax.min - ray_orig[axis]) * adinv;
-            auto t1 = (ax.max - ray_orig[axis]) * adinv;
+            auto t0 = (ax.min - ray_orig[axis]) * inv_dir[axis];
+            auto t1 = (ax.max - ray_orig[axis]) * inv_dir[axis];
 
-            if (t0 < t1) {
-                if (t0 > ray_t.min) ray_t.min = t0;
-                if (t1 < ray_t.max) ray_t.max = t1;
-            } else {
-                if (t1 > ray_t.min) ray_t.min = t1;
-                if (t0 < ray_t.max) ray_t.max = t0;
-            }
-
-            if (ray_t.max <= ray_t.min)
-                return false;
+            auto t_near = t0 < t1 ? t0 : t1;
+            auto t_far  = t0 < t1 ? t1 : t0;
+            ray_t.min = t_near > ray_t.min ? t_near : ray_t.min;
+            ray_t.max = t_far  < ray_t.max ? t_far  : ray_t.max;
         }
-        return true;
+        return ray_t.min < ray_t.max;
+    }
+
+    point3 centroid() const {
+        return point3(0.5*(x.min + x.max), 0.5*(y.min + y.max), 0.5*(z.min + z.max));
+    }
+
+    double surface_area() const {
+        auto dx = x.size(), dy = y.size(), dz = z.size();
+        return 2 * (dx*dy + dy*dz + dz*dx);
     }
 
     int longest_axis() const {
@@ -4,30 +4,330 @@
 #include "aabb.h"
 #include "hittable.h"
 #include "hittable_list.h"
+#include "tile_scheduler.h"
+#include "traversal_stats.h"
 
 #include <algorithm>
+#include <chrono>
+#include <functional>
+
+enum class bvh_split {
+    median,  // Sort on the longest axis and split at the object-count median
+    sah      // Binned surface area heuristic over object centroids
+};
+
+class bvh_sah {
+  // Binned surface area heuristic, shared by the BVH builders.
+  public:
+    // SAH cost of one box test and of one primitive intersection.
+    static constexpr double traversal_cost    = 0.125;
+    static constexpr double intersection_cost = 1.0;
+
+    // Number of centroid bins evaluated per axis.
+    static constexpr int bin_count = 16;
+
+    // Ranges are binned on up to one thread per this many elements.
+    static constexpr size_t parallel_chunk = 4096;
+
+    template <typename Iter, typename BoxOf>
+    static Iter partition(
+        Iter first, Iter last, double& split_cost, int& split_axis, BoxOf box_of, int threads = 1
+    ) {
+        // Bins the centroids of the boxes of [first, last) along each axis, picks the bin
+        // boundary with the lowest SAH cost and partitions the range around it, lower side
+        // first. Returns the split point and sets split_cost to the expected cost of the
+        // split, in the same units as intersection_cost, and split_axis to its axis. Returns
+        // first, leaving the range untouched, if no boundary separates the centroids.
+        //
+        // Large ranges are bounded and binned in chunks on up to `threads` threads. Box unions
+        // and counts merge exactly, so the split does not depend on the thread count.
+
+        // A range that fits in one chunk is bounded and binned in place: no scratch vectors,
+        // no trip through the pool.
+        auto element_count = size_t(last - first);
+        auto chunks = std::clamp(element_count / parallel_chunk, size_t(1), size_t(std::max(threads, 1)));
+        auto chunk_first = [&](size_t c) { return first + std::ptrdiff_t(element_count * c / chunks); };
+
+        auto bound_range = [&](Iter begin, Iter end, aabb& bounds, aabb& centroids) {
+            for (auto it = begin; it != end; ++it) {
+                aabb box = box_of(*it);
+                auto centroid = box.centroid();
+                bounds = aabb(bounds, box);
+                centroids = aabb(centroids, aabb(centroid, centroid));
+            }
+        };
+
+        aabb bounds = aabb::empty;
+        aabb centroid_bounds = aabb::empty;
+        if (chunks == 1) {
+            bound_range(first, last, bounds, centroid_bounds);
+        } else {
+            std::vector<aabb> chunk_bounds(chunks, aabb::empty);
+            std::vector<aabb> chunk_centroids(chunks, aabb::empty);
+            tile_scheduler::run_tasks(chunks, int(chunks), [&](size_t c) {
+                bound_range(chunk_first(c), chunk_first(c + 1), chunk_bounds[c], chunk_centroids[c]);
+            });
+            for (size_t c = 0; c < chunks; c++) {
+                bounds = aabb(bounds, chunk_bounds[c]);
+                centroid_bounds = aabb(centroid_bounds, chunk_centroids[c]);
+            }
+        }
+
+        // Axes where all centroids share one value are skipped: no boundary can separate
+        // them, and bin_index would divide by zero.
+        bool split_axes[3];
+        for (int axis = 0; axis < 3; axis++)
+            split_axes[axis] = centroid_bounds.axis_interval(axis).size() > 0;
+
+        auto bin_range = [&](Iter begin, Iter end, bin_set& bins) {
+            for (auto it = begin; it != end; ++it) {
+                aabb box = box_of(*it);
+                auto centroid = box.centroid();
+                for (int axis = 0; axis < 3; axis++) {
+                    if (!split_axes[axis])
+                        continue;
+                    auto b = bin_index(centroid[axis], centroid_bounds.axis_interval(axis));
+                    bins.counts[axis][b]++;
+                    bins.bounds[axis][b] = aabb(bins.bounds[axis][b], box);
+                }
+            }
+        };
+
+        bin_set bins;
+        if (chunks == 1) {
+            bin_range(first, last, bins);
+        } else {
+            std::vector<bin_set> chunk_bins(chunks);
+            tile_scheduler::run_tasks(chunks, int(chunks), [&](size_t c) {
+                bin_range(chunk_first(c), chunk_first(c + 1), chunk_bins[c]);
+            });
+            for (const auto& chunk : chunk_bins) {
+                for (int axis = 0; axis < 3; axis++) {
+                    for (int b = 0; b < bin_count; b++) {
+                        bins.counts[axis][b] += chunk.counts[axis][b];
+                        bins.bounds[axis][b] = aabb(bins.bounds[axis][b], chunk.bounds[axis][b]);
+                    }
+                }
+            }
+        }
+
+        int best_axis = -1;
+        int best_bin = 0;
+        double best_cost = infinity;
+
+        for (int axis = 0; axis < 3; axis++) {
+            if (!split_axes[axis])
+                continue;
+
+            const aabb* bin_bounds = bins.bounds[axis];
+            const size_t* bin_counts = bins.counts[axis];
+
+            // Sweep from the right to get the area and count of every right-hand side.
+            double right_area[bin_count];
+            size_t right_count[bin_count];
+            aabb running = aabb::empty;
+            size_t count = 0;
+            for (int b = bin_count - 1; b > 0; b--) {
+                running = aabb(running, bin_bounds[b]);
+                count += bin_counts[b];
+                right_area[b] = count ? running.surface_area() : 0;
+                right_count[b] = count;
+            }
+
+            // Sweep from the left, evaluating the split in front of each bin b.
+            running = aabb::empty;
+            count = 0;
+            for (int b = 1; b < bin_count; b++) {
+                running = aabb(running, bin_bounds[b-1]);
+                count += bin_counts[b-1];
+                if (count == 0 || right_count[b] == 0)
+                    continue;
+
+                auto cost = running.surface_area() * count + right_area[b] * right_count[b];
+                if (cost < best_cost) {
+                    best_cost = cost;
+                    best_axis = axis;
+                    best_bin = b;
+                }
+            }
+        }
+
+        if (best_axis < 0)
+            return first;
+
+        split_cost = traversal_cost + intersection_cost * best_cost / bounds.surface_area();
+        split_axis = best_axis;
+
+        const interval& extent = centroid_bounds.axis_interval(best_axis);
+        return std::partition(first, last, [&](const auto& element) {
+            return bin_index(box_of(element).centroid()[best_axis], extent) < best_bin;
+        });
+    }
+
+  private:
+    class bin_set {
+      public:
+        aabb bounds[3][bin_count];
+        size_t counts[3][bin_count] = {};
+    };
+
+    static int bin_index(double centroid, const interval& extent) {
+        auto b = int(bin_count * (centroid - extent.min) / extent.size());
+        return std::clamp(b, 0, bin_count - 1);
+    }
+};
 
 class bvh_node : public hittable {
   public:
-    bvh_node(hittable_list list) : bvh_node(list.objects, 0, list.objects.size()) {
+    bvh_node(hittable_list list, bvh_split split = bvh_split::median, int threads = 0) {
         // There's a C++ subtlety here. This constructor (without span indices) creates an
         // implicit copy of the hittable list, which we will modify. The lifetime of the copied
         // list only extends until this constructor exits. That's OK, because we only need to
         // persist the resulting bounding volume hierarchy.
+        //
+        // The tree is built on a pool of `threads` workers (0 = all hardware threads). The
+        // levels nearest the root are split on this thread, each partition binned across the
+        // pool; below them, every subtree is a task for the pool.
+
+        if (threads <= 0)
+            threads = tile_scheduler::default_thread_count();
+
+        // Aim for about four subtrees per worker, so uneven subtrees still balance.
+        int spawn_levels = 2;
+        for (int n = 1; n < threads; n *= 2)
+            spawn_levels++;
+
+        auto start_time = std::chrono::steady_clock::now();
+
+        std::vector<std::function<void()>> subtrees;
+        build(list.objects, 0, list.objects.size(), split, threads, spawn_levels, &subtrees);
+        tile_scheduler::run_tasks(subtrees.size(), threads, [&](size_t i) { subtrees[i](); });
+
+        build_seconds = std::chrono::duration<double>(
+            std::chrono::steady_clock::now() - start_time).count();
     }
 
-    bvh_node(std::vector<shared_ptr<hittable>>& objects, size_t start, size_t end) {
-        // Build the bounding box of the span of source objects.
-        bbox = aabb::empty;
-        for (size_t object_index=start; object_index < end; object_index++)
-            bbox = aabb(bbox, objects[object_index]->bounding_box());
+    bvh_node(std::vector<shared_ptr<hittable>>& objects, size_t start, size_t end,
+             bvh_split split = bvh_split::median)
+    {
+        build(objects, start, end, split, 1, 0, nullptr);
+    }
+
+    bool intersect(const ray& r, interval ray_t, hit_record& rec) const override {
+        record_node_visit(this);
+        if (!bbox.hit(r, ray_t))
+            return false;
+
+        bool hit_left = left->intersect(r, ray_t, rec);
+        bool hit_right = right->intersect(r, interval(ray_t.min, hit_left ? rec.t : ray_t.max), rec);
+
+        return hit_left || hit_right;
+    }
+
+    uint32_t intersect_packet(ray_packet& packet, uint32_t mask, hit_record recs[]) const override {
+        // The subtree is visited once for all lanes that enter the box, rather than per ray.
+        mask = packet.hit_box(bbox, mask);
+        if (!mask)
+            return 0;
+
+        auto hits = left->intersect_packet(packet, mask, recs);
+        return hits | right->intersect_packet(packet, mask, recs);
+    }
+
+    bool occluded(const ray& r, interval ray_t) const override {
+        if (!bbox.hit(r, ray_t))
+            return false;
+
+        return left->occluded(r, ray_t) || (right != left && right->occluded(r, ray_t));
+    }
+
+    aabb bounding_box() const override { return bbox; }
+
+    void gather_emitters(const shared_ptr<hittable>&, std::vector<emitter>& lights)
+    const override {
+        left->gather_emitters(left, lights);
+        if (right != left)
+            right->gather_emitters(right, lights);
+    }
 
+    double build_time() const {
+        // Wall-clock seconds spent building the tree, for nodes built from a hittable_list.
+        return build_seconds;
+    }
+
+    double sah_cost() const {
+        // Returns the expected cost of tracing a ray through this subtree, given that it hits
+        // this node's box: one traversal step here, plus the cost of each child weighted by
+        // the probability (surface area ratio) that the ray also hits the child's box.
+        if (left == right)
+            return bvh_sah::traversal_cost + subtree_cost(left);
+
+        auto area = bbox.surface_area();
+        return bvh_sah::traversal_cost
+             + left->bounding_box().surface_area() / area * subtree_cost(left)
+             + right->bounding_box().surface_area() / area * subtree_cost(right);
+    }
+
+    static size_t partition_median(
+        std::vector<shared_ptr<hittable>>& objects, size_t start, size_t end, const aabb& bbox
+    ) {
+        // Sorts the span on the longest axis of its bounding box and returns the middle index.
         int axis = bbox.longest_axis();
 
         auto comparator = (axis == 0) ? box_x_compare
                         : (axis == 1) ? box_y_compare
                                       : box_z_compare;
 
+        std::sort(std::begin(objects) + start, std::begin(objects) + end, comparator);
+        return start + (end - start)/2;
+    }
+
+    static size_t partition_sah(
+        std::vector<shared_ptr<hittable>>& objects, size_t start, size_t end, int threads = 1
+    ) {
+        // Partitions the span at the best SAH split and returns the split index, falling back
+        // to a median split when the centroids cannot be separated. Binning runs on up to
+        // `threads` threads.
+
+        auto first = std::begin(objects) + start;
+        auto last  = std::begin(objects) + end;
+        double split_cost;
+        int split_axis;
+        auto middle = bvh_sah::partition(first, last, split_cost, split_axis,
+            [](const shared_ptr<hittable>& object) { return object->bounding_box(); }, threads);
+
+        if (middle == first) {
+            middle = first + (end - start)/2;
+            std::nth_element(first, middle, last, box_x_compare);
+        }
+
+        return size_t(middle - std::begin(objects));
+    }
+
+  private:
+    shared_ptr<hittable> left;
+    shared_ptr<hittable> right;
+    aabb bbox;
+    double build_seconds = 0;
+
+    // Spans smaller than this are never split further before becoming a pool task.
+    static constexpr size_t parallel_span = 4096;
+
+    bvh_node() {}
+
+    void build(std::vector<shared_ptr<hittable>>& objects, size_t start, size_t end,
+               bvh_split split, int threads, int spawn_levels,
+               std::vector<std::function<void()>>* subtrees)
+    {
+        // Builds the node for the span. With a subtrees list, the span's children become tasks
+        // on it once spawn_levels more levels have been split or once they are small; without
+        // one, the whole subtree is built here.
+
+        // Build the bounding box of the span of source objects.
+        bbox = aabb::empty;
+        for (size_t object_index=start; object_index < end; object_index++)
+            bbox = aabb(bbox, objects[object_index]->bounding_box());
+
         size_t object_span = end - start;
 
         if (object_span == 1) {
@@ -36,50 +336,58 @@ class bvh_node : public hittable {
             left = objects[start];
             right = objects[start+1];
         } else {
-            std::sort(std::begin(objects) + start, std::begin(objects) + end, comparator);
+            auto mid = (split == bvh_split::sah) ? partition_sah(objects, start, end, threads)
+                                                 : partition_median(objects, start, end, bbox);
 
-            auto mid = start + object_span/2;
-            left = make_shared<bvh_node>(objects, start, mid);
-            right = make_shared<bvh_node>(objects, mid, end);
+            build_child(left, objects, start, mid, split, threads, spawn_levels, subtrees);
+            build_child(right, objects, mid, end, split, threads, spawn_levels, subtrees);
         }
     }
 
-    bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
-        if (!bbox.hit(r, ray_t))
-            return false;
-
-        bool hit_left = left->hit(r, ray_t, rec);
-        bool hit_right = right->hit(r, interval(ray_t.min, hit_left ? rec.t : ray_t.max), rec);
-
-        return hit_left || hit_right;
+    static void build_child(
+        shared_ptr<hittable>& child, std::vector<shared_ptr<hittable>>& objects,
+        size_t start, size_t end, bvh_split split, int threads, int spawn_levels,
+        std::vector<std::function<void()>>* subtrees
+    ) {
+        if (!subtrees) {
+            child = make_shared<bvh_node>(objects, start, end, split);
+        } else if (spawn_levels <= 1 || end - start < parallel_span) {
+            // Children cover disjoint spans of the array, so the tasks can run in any order
+            // and the tree comes out the same as a serial build.
+            subtrees->push_back([&child, &objects, start, end, split] {
+                child = make_shared<bvh_node>(objects, start, end, split);
+            });
+        } else {
+            auto node = shared_ptr<bvh_node>(new bvh_node());
+            node->build(objects, start, end, split, threads, spawn_levels - 1, subtrees);
+            child = node;
+        }
     }
 
-    aabb bounding_box() const override { return bbox; }
-
-  private:
-    shared_ptr<hittable> left;
-    shared_ptr<hittable> right;
-    aabb bbox;
+    static double subtree_cost(const shared_ptr<hittable>& object) {
+        auto node = dynamic_cast<const bvh_node*>(object.get());
+        return node ? node->sah_cost() : bvh_sah::intersection_cost;
+    }
 
     static bool box_compare(
-        const shared_ptr<hittable> a, const shared_ptr<hittable> b, int axis_index
+        const shared_ptr<hittable>& a, const shared_ptr<hittable>& b, int axis_index
     ) {
         auto a_axis_interval = a->bounding_box().axis_interval(axis_index);
         auto b_axis_interval = b->bounding_box().axis_interval(axis_index);
         return a_axis_interval.min < b_axis_interval.min;
     }
 
-    static bool box_x_compare (const shared_ptr<hittable> a, const shared_ptr<hittable> b) {
+    static bool box_x_compare (const shared_ptr<hittable>& a, const shared_ptr<hittable>& b) {
         return box_compare(a, b, 0);
     }
 
-    static bool box_y_compare (const shared_ptr<hittable> a, const shared_ptr<hittable> b) {
+    static bool box_y_compare (const shared_ptr<hittable>& a, const shared_ptr<hittable>& b) {
         return box_compare(a, b, 1);
     }
 
-    static bool box_z_compare (const shared_ptr<hittable> a, const shared_ptr<hittable> b) {
+    static bool box_z_compare (const shared_ptr<hittable>& a, const shared_ptr<hittable>& b) {
         return box_compare(a, b, 2);
     }
 };
 
-#endif
\ No newline at end of file
+#endif
@@ -5,6 +5,16 @@
 #include "pdf.h"
 #include "material.h"
 #include "denoiser.h"
+#include "tile_scheduler.h"
+#include "traversal_stats.h"
+#include "wavefront.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <mutex>
 #include <vector>
 
 // Include stb_image_write for PNG export
@@ -17,6 +27,8 @@ class camera {
     int    image_width  = 100;  // Rendered image width in pixel count
     int    samples_per_pixel = 10;   // Count of random samples for each pixel
     int    max_depth         = 10;   // Maximum number of ray bounces into scene
+    bool   russian_roulette  = true; // Randomly end paths whose throughput has become small
+    int    roulette_depth    = 3;    // Bounces before Russian roulette may end a path
     color  background;               // Scene background color
 
     double vfov = 90;  // Vertical view angle (field of view)
@@ -30,6 +42,33 @@ class camera {
     bool   denoise = false;    // Enable denoising post-processing
     std::string denoise_mode = "bilateral";  // "bilateral", "median", or "fast"
 
+    int    num_threads = 0;    // Render worker threads (0 = all hardware threads)
+    int    tile_size   = 16;   // Edge length in pixels of the square tiles handed to workers
+    int    frame       = 0;    // Frame number, mixed into every sample's random seed
+
+    std::string sampler_type = "independent";  // "independent", "sobol", or "owen"
+    std::string integrator   = "mixture";      // "mixture" or "nee" (next-event estimation)
+    bool   packet_tracing = false;  // Trace each pixel's camera rays together (AVX builds only)
+    bool   wavefront = false;       // Trace each tile's paths together, one stage at a time
+    int    wavefront_paths = 4096;  // Paths each worker keeps in flight in wavefront mode
+    bool   sort_rays = false;       // Wavefront: bin bounce rays by direction and origin first
+    bool   ray_stats = false;       // Wavefront: log BVH nodes visited per batch of bounce rays
+                                    // (builds with RT_TRAVERSAL_STATS only)
+
+    bool   adaptive = false;            // Stop sampling each pixel once its estimate converges
+    double adaptive_threshold = 0.02;   // Relative standard error at which a pixel stops
+    int    adaptive_min_samples = 16;   // Samples every pixel takes before it may stop
+    double adaptive_budget = 0;         // Average samples per pixel for the whole image (0 = none)
+    std::string heatmap_file;           // If set, PNG of the samples each pixel took
+
+    bool   progressive = false;         // Render the whole image in passes of doubling spp
+    double time_budget = 0;             // Seconds before a progressive render stops (0 = none)
+    double snapshot_interval = 0;       // Seconds between progressive snapshots (0 = none)
+    std::string snapshot_file;          // PNG rewritten with the image so far at each snapshot
+
+    std::string checkpoint_file;        // If set, render state is saved here and resumed from
+    double checkpoint_interval = 60;    // Seconds between checkpoints (0 = after every tile)
+
     void render(const hittable& world, const hittable& lights) {
         render_to_file("", world, lights);
     }
@@ -44,21 +83,11 @@ class camera {
         }
 
         // Otherwise output PPM to stdout
-        std::cout << "P3\n" << image_width << ' ' << image_height << "\n255\n";
+        std::vector<color> color_buffer = render_tiles(world, lights);
 
-        for (int j = 0; j < image_height; j++) {
-            print_progress(j, image_height);
-            for (int i = 0; i < image_width; i++) {
-                color pixel_color(0,0,0);
-                for (int s_j = 0; s_j < sqrt_spp; s_j++) {
-                    for (int s_i = 0; s_i < sqrt_spp; s_i++) {
-                        ray r = get_ray(i, j, s_i, s_j);
-                        pixel_color += ray_color(r, max_depth, world, lights);
-                    }
-                }
-                write_color(std::cout, pixel_samples_scale * pixel_color);
-            }
-        }
+        std::cout << "P3\n" << image_width << ' ' << image_height << "\n255\n";
+        for (const auto& pixel_color : color_buffer)
+            write_color(std::cout, pixel_color);
 
         std::clog << "\rDone.                 \n";
     }
@@ -67,21 +96,7 @@ class camera {
         initialize();
 
         // First pass: render to color buffer for potential denoising
-        std::vector<color> color_buffer(image_width * image_height);
-
-        for (int j = 0; j < image_height; j++) {
-            print_progress(j, image_height);
-            for (int i = 0; i < image_width; i++) {
-                color pixel_color(0,0,0);
-                for (int s_j = 0; s_j < sqrt_spp; s_j++) {
-                    for (int s_i = 0; s_i < sqrt_spp; s_i++) {
-                        ray r = get_ray(i, j, s_i, s_j);
-                        pixel_color += ray_color(r, max_depth, world, lights);
-                    }
-                }
-                color_buffer[j * image_width + i] = pixel_samples_scale * pixel_color;
-            }
-        }
+        std::vector<color> color_buffer = render_tiles(world, lights);
 
         // Apply denoising if enabled
         std::vector<color> final_buffer = color_buffer;
@@ -96,11 +111,18 @@ class camera {
             }
         }
 
-        // Convert to PNG
+        if (write_png(filename, final_buffer))
+            std::clog << "Saved to: " << filename << "\n";
+        std::clog << "\n";
+    }
+
+    bool write_png(const std::string& filename, const std::vector<color>& buffer) const {
+        // Writes a linear color buffer as a gamma-corrected PNG. Reports an error and returns
+        // false if the file can't be written.
         std::vector<unsigned char> image(image_width * image_height * 3);
         for (int j = 0; j < image_height; j++) {
             for (int i = 0; i < image_width; i++) {
-                color pixel_color = final_buffer[j * image_width + i];
+                color pixel_color = buffer[j * image_width + i];
                 
                 // Convert to PNG pixel format (linear to gamma)
                 auto clamp_val = [](double x) { return x < 0 ? 0 : (x > 0.999 ? 0.999 : x); };
@@ -115,15 +137,62 @@ class camera {
             }
         }
 
-        if (stbi_write_png(filename.c_str(), image_width, image_height, 3, image.data(), image_width * 3)) {
-            std::clog << "Saved to: " << filename << "\n";
-        } else {
+        if (!stbi_write_png(filename.c_str(), image_width, image_height, 3, image.data(), image_width * 3)) {
             std::cerr << "Error: Failed to write PNG file " << filename << "\n";
+            return false;
         }
-        std::clog << "\n";
+        return true;
     }
 
-    void print_progress(int current, int total) {
+    void measure_camera_rays(const hittable& world, int samples = 8) {
+        // Finds the closest hit of `samples` camera rays per pixel, first one ray at a time
+        // and then in packets, and logs the rate of each in millions of rays per second.
+        // Nothing is shaded, so this times ray casting alone.
+        initialize();
+        samples = std::max(1, samples);
+
+        for (bool packets : { false, true }) {
+            tile_scheduler scheduler(image_width, image_height, tile_size);
+            std::atomic<uint64_t> hit_count{0};
+            auto start = render_clock::now();
+
+            scheduler.run(num_threads, [&](const tile& t) {
+                uint64_t tile_hits = 0;
+                for (int j = t.y0; j < t.y1; j++) {
+                    for (int i = t.x0; i < t.x1; i++) {
+                        for (int s = 0; s < samples; ) {
+                            if (packets) {
+                                auto count = std::min(ray_packet::size, samples - s);
+                                ray_packet packet;
+                                hit_record recs[ray_packet::size];
+                                random_state states[ray_packet::size];
+                                auto hits = trace_camera_packet(i, j, s, count, world, packet, recs, states);
+                                for (; hits; hits &= hits - 1)
+                                    tile_hits++;
+                                s += count;
+                            } else {
+                                begin_sample(i, j, s);
+                                hit_record rec;
+                                if (world.hit(get_ray(i, j, s % sqrt_spp, s / sqrt_spp), interval(0.001, infinity), rec))
+                                    tile_hits++;
+                                s++;
+                            }
+                        }
+                    }
+                }
+                end_pixel_samples();
+                hit_count += tile_hits;
+            });
+
+            auto seconds = std::chrono::duration<double>(render_clock::now() - start).count();
+            auto rays = double(image_width) * image_height * samples;
+            std::clog << (packets ? "Packets of " + std::to_string(ray_packet::size) : std::string("Single rays"))
+                      << ": " << rays / seconds * 1e-6 << " Mrays/s, "
+                      << 100.0 * hit_count / rays << "% hit\n";
+        }
+    }
+
+    void print_progress(int current, int total) const {
         int percent = (current * 100) / total;
         int bar_width = 50;
         int filled = (percent * bar_width) / 100;
@@ -138,7 +207,6 @@ class camera {
 
   private:
     int    image_height;   // Rendered image height
-    double pixel_samples_scale;  // Color scale factor for a sum of pixel samples
     int sqrt_spp;             // Square root of number of samples per pixel
     double recip_sqrt_spp;       // 1 / sqrt_spp
     point3 center;         // Camera center
@@ -148,15 +216,746 @@ class camera {
     vec3   u, v, w;              // Camera frame basis vectors
     vec3   defocus_disk_u;       // Defocus disk horizontal radius
     vec3   defocus_disk_v;       // Defocus disk vertical radius
+    shared_ptr<sampler> sample_source;  // Backend supplying each path's sample vector
+    bool   use_nee;           // Integrator connects each diffuse vertex to a light sample
+    bool   stratify_pixels;   // Place sub-pixel offsets by stratum, not from the sampler
+
+    class pixel_estimate {
+      // Running state of one pixel, kept across the passes of a progressive render.
+      public:
+        color  sum = color(0,0,0);  // Sum of the samples taken so far
+        int    samples = 0;
+        double mean = 0, m2 = 0;    // Welford statistics of the sample luminance
+        bool   converged = false;   // Adaptive sampling has stopped this pixel
+    };
+
+    using render_clock = std::chrono::steady_clock;
+
+    class film_commits {
+      // Workers render each tile into a private copy and commit it to the film under this
+      // lock, so the film only ever holds whole tiles and a checkpoint can be taken at any
+      // commit.
+      public:
+        std::mutex lock;
+        render_clock::time_point last_checkpoint = render_clock::now();
+        render_clock::time_point last_snapshot = render_clock::now();
+        coherence_stats coherence;  // Committed tiles' ray_stats, if measured
+    };
+
+    std::vector<color> render_tiles(const hittable& world, const hittable& lights) const {
+        // Renders every pixel into a row-major color buffer, splitting the image into tiles
+        // that are spread across the worker threads. A progressive render covers the image
+        // in several passes instead of one. With a checkpoint file, the render picks up from
+        // the saved film, if any, and leaves a checkpoint behind unless it runs to the end.
+
+        material_table::freeze_guard frozen_materials;
+
+#ifndef RT_PACKET_AVX
+        // Without AVX, packets trace camera rays slower than one at a time.
+        if (packet_tracing && !wavefront)
+            std::cerr << "Warning: Packet tracing needs an AVX build (e.g. -march=native); "
+                         "tracing single rays\n";
+#endif
+
+        std::vector<pixel_estimate> film(image_width * image_height);
+        auto total_samples = sqrt_spp * sqrt_spp;
+        film_commits commits;
+
+        if (!checkpoint_file.empty() && load_checkpoint(film))
+            std::clog << "Resuming from checkpoint " << checkpoint_file << "\n";
+
+        bool complete = true;
+        if (progressive)
+            complete = render_progressive(world, lights, film, commits, total_samples);
+        else if (adaptive && adaptive_budget > 0)
+            render_budgeted(world, lights, film, commits, total_samples);
+        else
+            render_pass(world, lights, film, commits, 0, total_samples, render_clock::time_point::max(), true);
+
+        if (!checkpoint_file.empty()) {
+            if (complete)
+                std::remove(checkpoint_file.c_str());
+            else
+                save_checkpoint(film);
+        }
+
+        if (adaptive)
+            report_samples(film);
+
+        if (wavefront && ray_stats) {
+            if (traversal_stats_enabled)
+                report_coherence(commits.coherence);
+            else
+                std::cerr << "\nWarning: Ray stats need a build with RT_TRAVERSAL_STATS defined\n";
+        }
+
+        return resolve(film);
+    }
+
+    bool render_progressive(
+        const hittable& world, const hittable& lights, std::vector<pixel_estimate>& film,
+        film_commits& commits, int total_samples
+    ) const {
+        // Each pass adds as many samples per pixel as all earlier passes together (1, 1, 2,
+        // 4, ...), so a usable image appears early. Stops at total_samples or time_budget,
+        // whichever comes first; a pass cut short by the budget leaves the pixels it hadn't
+        // finished with the samples they already had. Returns whether every pass ran.
+
+        auto start = render_clock::now();
+        auto deadline = render_clock::time_point::max();
+        if (time_budget > 0)
+            deadline = start + std::chrono::duration_cast<render_clock::duration>(
+                std::chrono::duration<double>(time_budget));
+
+        auto seconds_since = [](render_clock::time_point t) {
+            return std::chrono::duration<double>(render_clock::now() - t).count();
+        };
+
+        int pass = 0;
+        for (int first = 0; first < total_samples; ) {
+            int last = std::min(total_samples, std::max(1, 2 * first));
+            if (adaptive && adaptive_budget > 0)
+                fit_sample_budget(film, first, last);
+
+            bool complete = render_pass(world, lights, film, commits, first, last, deadline, false);
+            ++pass;
+
+            if (!complete) {
+                std::clog << "\rPass " << pass << " cut short by the time budget after "
+                          << seconds_since(start) << " s\n";
+                return false;
+            }
+
+            std::clog << "\rPass " << pass << ": " << last << " samples per pixel, "
+                      << seconds_since(start) << " s" << std::flush;
+
+            if (last < total_samples && render_clock::now() >= deadline) {
+                std::clog << " (time budget reached)\n";
+                return false;
+            }
+
+            first = last;
+        }
+
+        std::clog << "\n";
+        return true;
+    }
+
+    void render_budgeted(
+        const hittable& world, const hittable& lights, std::vector<pixel_estimate>& film,
+        film_commits& commits, int total_samples
+    ) const {
+        // Adaptive sampling under adaptive_budget. Samples go out in rounds of
+        // adaptive_min_samples per pixel, and before each round fit_sample_budget stops the
+        // least noisy pixels if the round could overrun the budget, so the samples that are
+        // left go to the noisiest pixels.
+        auto round_size = std::max(1, adaptive_min_samples);
+        for (int first = 0; first < total_samples; first += round_size) {
+            int last = std::min(total_samples, first + round_size);
+            if (!fit_sample_budget(film, first, last))
+                break;
+
+            render_pass(world, lights, film, commits, first, last, render_clock::time_point::max(), false);
+            std::clog << "\rRound " << first / round_size + 1 << ": up to " << last
+                      << " samples per pixel" << std::flush;
+        }
+        std::clog << "\n";
+    }
+
+    bool fit_sample_budget(std::vector<pixel_estimate>& film, int first_sample, int last_sample) const {
+        // Stops pixels, least noisy first, until a pass of samples [first_sample, last_sample)
+        // fits in what is left of adaptive_budget. Each pixel still sampling is charged the
+        // whole pass, though it may converge sooner, so the budget is never overrun. It never
+        // drops below adaptive_min_samples per pixel. Returns whether any pixel still samples.
+        auto budget = std::fmax(adaptive_budget, adaptive_min_samples) * double(film.size());
+        double spent = 0;
+        double cost = 0;
+
+        auto pass_samples = [&](const pixel_estimate& pixel) {
+            return pixel.converged ? 0 : std::max(0, last_sample - std::max(first_sample, pixel.samples));
+        };
+
+        std::vector<std::pair<double, size_t>> sampling;  // Relative noise and pixel index
+        for (size_t p = 0; p < film.size(); p++) {
+            spent += film[p].samples;
+            if (auto samples = pass_samples(film[p])) {
+                cost += samples;
+                sampling.emplace_back(relative_noise(film[p]), p);
+            }
+        }
+
+        if (spent + cost > budget) {
+            std::sort(sampling.begin(), sampling.end());
+            for (const auto& [noise, p] : sampling) {
+                if (spent + cost <= budget)
+                    break;
+                cost -= pass_samples(film[p]);
+                film[p].converged = true;
+            }
+        }
+
+        return cost > 0;
+    }
+
+    bool render_pass(
+        const hittable& world, const hittable& lights, std::vector<pixel_estimate>& film,
+        film_commits& commits, int first_sample, int last_sample,
+        render_clock::time_point deadline, bool show_progress
+    ) const {
+        // Adds samples [first_sample, last_sample) to every pixel that hasn't converged,
+        // skipping the samples a pixel already has from a resumed checkpoint. Once the
+        // deadline passes, pixels not yet started keep the samples they have, and the paths
+        // already in flight finish; returns false if that happened. Tiles are committed to
+        // the film as they finish, which is also when checkpoints and snapshots are written.
+
+        tile_scheduler scheduler(image_width, image_height, tile_size);
+
+        size_t tiles_done = 0;
+        std::atomic<bool> cut_short{false};
+        bool timed = deadline != render_clock::time_point::max();
+
+        scheduler.run(num_threads, [&](const tile& t) {
+            // Only this worker writes the tile's pixels, so reading them here needs no lock.
+            std::vector<pixel_estimate> tile_film;
+            tile_film.reserve(size_t(t.x1 - t.x0) * (t.y1 - t.y0));
+
+            for (int j = t.y0; j < t.y1; j++) {
+                for (int i = t.x0; i < t.x1; i++) {
+                    tile_film.push_back(film[j * image_width + i]);
+                    if (wavefront || cut_short)
+                        continue;
+
+                    if (timed && render_clock::now() >= deadline) {
+                        cut_short = true;
+                        continue;
+                    }
+
+                    // Samples are always taken in order, so a pixel's count is also the index
+                    // of its next sample.
+                    auto first = std::max(first_sample, tile_film.back().samples);
+#ifdef RT_PACKET_AVX
+                    if (packet_tracing) {
+                        render_pixel_packets(tile_film.back(), i, j, first, last_sample, world, lights);
+                        continue;
+                    }
+#endif
+                    render_pixel(tile_film.back(), i, j, first, last_sample, world, lights);
+                }
+            }
+
+            coherence_stats tile_coherence;
+            if (wavefront && !cut_short) {
+                bool complete = render_tile_wavefront(
+                    t, tile_film, first_sample, last_sample, deadline, world, lights,
+                    ray_stats && traversal_stats_enabled ? &tile_coherence : nullptr);
+                if (!complete)
+                    cut_short = true;
+            }
+
+            end_pixel_samples();
+
+            std::lock_guard<std::mutex> guard(commits.lock);
+            commits.coherence += tile_coherence;
+
+            auto committed = tile_film.begin();
+            for (int j = t.y0; j < t.y1; j++) {
+                for (int i = t.x0; i < t.x1; i++)
+                    film[j * image_width + i] = *committed++;
+            }
+
+            if (show_progress)
+                print_progress(int(++tiles_done), int(scheduler.tile_count()));
+
+            // Other workers wait at their next commit while the checkpoint is written.
+            if (!checkpoint_file.empty()) {
+                auto since = std::chrono::duration<double>(render_clock::now() - commits.last_checkpoint);
+                if (since.count() >= checkpoint_interval) {
+                    save_checkpoint(film);
+                    commits.last_checkpoint = render_clock::now();
+                }
+            }
+
+            if (snapshot_interval > 0 && !snapshot_file.empty()) {
+                auto since = std::chrono::duration<double>(render_clock::now() - commits.last_snapshot);
+                if (since.count() >= snapshot_interval) {
+                    write_png(snapshot_file, resolve(film));
+                    commits.last_snapshot = render_clock::now();
+                }
+            }
+        });
+
+        return !cut_short;
+    }
+
+    // Checkpoint file layout, in native byte order: the magic bytes, a header of the settings
+    // the samples depend on, then per pixel its sample count, converged flag and color sum,
+    // followed by the Welford mean and M2 when sampling is adaptive. Random numbers are
+    // derived from (pixel, sample, frame) alone, so a pixel's sample count is all the
+    // random state there is to save.
+    static constexpr char checkpoint_magic[8] = {'R','T','C','K','P','T','0','1'};
+
+    std::string checkpoint_settings() const {
+        // Everything besides the scene that decides which samples a pixel takes. A checkpoint
+        // made under other settings is ignored.
+        return std::to_string(image_width) + 'x' + std::to_string(image_height)
+             + " spp " + std::to_string(samples_per_pixel)
+             + " depth " + std::to_string(max_depth)
+             + " frame " + std::to_string(frame)
+             + " rr " + std::to_string(russian_roulette) + ' ' + std::to_string(roulette_depth)
+             + " sampler " + sampler_type + " integrator " + integrator
+             + " adaptive " + (adaptive ? std::to_string(adaptive_threshold) + ' '
+                                        + std::to_string(adaptive_min_samples) : "off")
+             + (adaptive && adaptive_budget > 0 ? " budget " + std::to_string(adaptive_budget) : "")
+             + " progressive " + std::to_string(progressive)
+             + " precision " + std::to_string(sizeof(real) * 8);
+    }
+
+    void save_checkpoint(const std::vector<pixel_estimate>& film) const {
+        // Writes to a temporary file first and renames it over the old checkpoint, so being
+        // killed mid-write leaves the previous checkpoint intact.
+        auto temp_file = checkpoint_file + ".tmp";
+        {
+            std::ofstream out(temp_file, std::ios::binary | std::ios::trunc);
+            auto settings = checkpoint_settings();
+            auto settings_size = uint32_t(settings.size());
+
+            out.write(checkpoint_magic, sizeof checkpoint_magic);
+            out.write(reinterpret_cast<const char*>(&settings_size), sizeof settings_size);
+            out.write(settings.data(), settings_size);
+
+            for (const auto& pixel : film) {
+                auto samples = uint32_t(pixel.samples);
+                auto converged = uint8_t(pixel.converged);
+                double sum[3] = { pixel.sum.x(), pixel.sum.y(), pixel.sum.z() };
+                out.write(reinterpret_cast<const char*>(&samples), sizeof samples);
+                out.write(reinterpret_cast<const char*>(&converged), sizeof converged);
+                out.write(reinterpret_cast<const char*>(sum), sizeof sum);
+                if (adaptive) {
+                    out.write(reinterpret_cast<const char*>(&pixel.mean), sizeof pixel.mean);
+                    out.write(reinterpret_cast<const char*>(&pixel.m2), sizeof pixel.m2);
+                }
+            }
+
+            if (!out) {
+                std::cerr << "Error: Failed to write checkpoint " << temp_file << "\n";
+                return;
+            }
+        }
+
+        if (std::rename(temp_file.c_str(), checkpoint_file.c_str()) != 0)
+            std::cerr << "Error: Failed to replace checkpoint " << checkpoint_file << "\n";
+    }
+
+    bool load_checkpoint(std::vector<pixel_estimate>& film) const {
+        // Fills the film from the checkpoint file. Returns false, leaving the film untouched,
+        // if there is no checkpoint or it was made for different settings.
+        std::ifstream in(checkpoint_file, std::ios::binary);
+        if (!in)
+            return false;
+
+        char magic[sizeof checkpoint_magic];
+        uint32_t settings_size = 0;
+        in.read(magic, sizeof magic);
+        in.read(reinterpret_cast<char*>(&settings_size), sizeof settings_size);
+
+        auto expected = checkpoint_settings();
+        std::string settings(settings_size == expected.size() ? settings_size : 0, '\0');
+        in.read(&settings[0], std::streamsize(settings.size()));
+
+        if (!in || std::memcmp(magic, checkpoint_magic, sizeof magic) != 0 || settings != expected) {
+            std::cerr << "Warning: Ignoring checkpoint " << checkpoint_file
+                      << ", which was made for different render settings\n";
+            return false;
+        }
+
+        std::vector<pixel_estimate> loaded(film.size());
+        for (auto& pixel : loaded) {
+            uint32_t samples;
+            uint8_t converged;
+            double sum[3];
+            in.read(reinterpret_cast<char*>(&samples), sizeof samples);
+            in.read(reinterpret_cast<char*>(&converged), sizeof converged);
+            in.read(reinterpret_cast<char*>(sum), sizeof sum);
+            if (adaptive) {
+                in.read(reinterpret_cast<char*>(&pixel.mean), sizeof pixel.mean);
+                in.read(reinterpret_cast<char*>(&pixel.m2), sizeof pixel.m2);
+            }
+            pixel.samples = int(samples);
+            pixel.converged = converged != 0;
+            pixel.sum = color(sum[0], sum[1], sum[2]);
+        }
+
+        if (!in) {
+            std::cerr << "Warning: Ignoring truncated checkpoint " << checkpoint_file << "\n";
+            return false;
+        }
+
+        film = std::move(loaded);
+        return true;
+    }
+
+    void render_pixel(
+        pixel_estimate& pixel, int i, int j, int first_sample, int last_sample,
+        const hittable& world, const hittable& lights
+    ) const {
+        for (int s = first_sample; s < last_sample && !pixel.converged; s++) {
+            begin_sample(i, j, s);
+            ray r = get_ray(i, j, s % sqrt_spp, s / sqrt_spp);
+            add_sample(pixel, ray_color(r, world, lights));
+        }
+    }
+
+#ifdef RT_PACKET_AVX
+    void render_pixel_packets(
+        pixel_estimate& pixel, int i, int j, int first_sample, int last_sample,
+        const hittable& world, const hittable& lights
+    ) const {
+        // Like render_pixel, but the camera rays of up to ray_packet::size samples at a time
+        // are traced as one packet. Each sample then resumes from the random state it had
+        // when its camera ray was drawn, so it draws the same numbers as in render_pixel.
+        for (int s = first_sample; s < last_sample && !pixel.converged; ) {
+            auto count = std::min(ray_packet::size, last_sample - s);
+            ray_packet packet;
+            hit_record recs[ray_packet::size];
+            random_state states[ray_packet::size];
+            auto hits = trace_camera_packet(i, j, s, count, world, packet, recs, states);
+
+            for (int k = 0; k < count && !pixel.converged; k++, s++) {
+                states[k].restore();
+                bool hit = hits & ray_packet::lane_bit(k);
+                add_sample(pixel, ray_color(packet.lane_ray(k), hit, recs[k], world, lights));
+            }
+        }
+    }
+#endif
+
+    uint32_t trace_camera_packet(
+        int i, int j, int first_sample, int count, const hittable& world,
+        ray_packet& packet, hit_record recs[], random_state states[]
+    ) const {
+        // Draws the camera rays of samples [first_sample, first_sample + count) of pixel i, j
+        // and finds their closest hits together, with complete hit records. Returns the lanes
+        // that hit; states holds each sample's random state as of its camera ray. Lanes past
+        // count repeat the first ray, but aren't traced.
+        packet.lane_random = states;
+        for (int k = 0; k < ray_packet::size; k++) {
+            auto s = first_sample + k;
+            if (k < count) {
+                begin_sample(i, j, s);
+                packet.set(k, get_ray(i, j, s % sqrt_spp, s / sqrt_spp), interval(0.001, infinity));
+                states[k].save();
+            } else {
+                packet.set(k, packet.lane_ray(0), interval(0.001, infinity));
+            }
+        }
+
+        auto lanes = (uint32_t(1) << count) - 1;
+        auto hits = world.intersect_packet(packet, lanes, recs);
+        for (int k = 0; k < count; k++) {
+            if (hits & ray_packet::lane_bit(k))
+                recs[k].object->finalize(packet.lane_ray(k), recs[k]);
+        }
+        return hits;
+    }
+
+    class wavefront_item {
+      // One sample for the wavefront stages to compute: sample `sample` of the tile's pixel
+      // `pixel`, counted in scanline order from the tile's upper left corner.
+      public:
+        int pixel;
+        int sample;
+    };
+
+    bool render_tile_wavefront(
+        const tile& t, std::vector<pixel_estimate>& tile_film, int first_sample, int last_sample,
+        render_clock::time_point deadline, const hittable& world, const hittable& lights,
+        coherence_stats* stats
+    ) const {
+        // Like render_pixel for every pixel of the tile, but the samples are traced as one
+        // wavefront. Results are added to each pixel in sample order once they are all back.
+        // With adaptive sampling, the samples go out in rounds of adaptive_min_samples per
+        // pixel, and the rest of a round is dropped once a pixel converges, so every pixel
+        // stops at the same sample as in render_pixel. Past the deadline, no new paths start
+        // and pixels keep the samples that came back; returns false if that happened.
+        auto width = t.x1 - t.x0;
+        auto round_size = adaptive ? std::max(1, adaptive_min_samples) : last_sample;
+
+        std::vector<wavefront_item> work;
+        std::vector<color> results;
+
+        for (bool more = true; more; ) {
+            more = false;
+            work.clear();
+            for (int p = 0; p < int(tile_film.size()); p++) {
+                const auto& pixel = tile_film[p];
+                if (pixel.converged)
+                    continue;
+                auto first = std::max(first_sample, pixel.samples);
+                auto last = std::min(last_sample, first + round_size);
+                for (int s = first; s < last; s++)
+                    work.push_back(wavefront_item{p, s});
+                more = more || last < last_sample;
+            }
+
+            results.assign(work.size(), color(0,0,0));
+            auto traced = trace_wavefront(t.x0, t.y0, width, work, results, deadline, world, lights, stats);
+
+            for (size_t w = 0; w < traced; w++) {
+                auto& pixel = tile_film[work[w].pixel];
+                if (!pixel.converged)
+                    add_sample(pixel, results[w]);
+            }
+
+            if (traced < work.size())
+                return false;
+        }
+        return true;
+    }
+
+    size_t trace_wavefront(
+        int x0, int y0, int width, const std::vector<wavefront_item>& work,
+        std::vector<color>& results, render_clock::time_point deadline,
+        const hittable& world, const hittable& lights, coherence_stats* stats
+    ) const {
+        // Computes the radiance of every work item into results, keeping up to
+        // wavefront_paths of them in flight. Each path carries its own random state from stage
+        // to stage, so it draws the same numbers as in ray_color whatever order the stages
+        // take the paths in; only the visibility tests of shadow rays, which run in a later
+        // stage, draw from a copy. Given stats, the BVH nodes visited by the bounce rays are
+        // counted in batches of coherence_batch rays. Past the deadline, no new camera paths
+        // are generated; returns the number of work items traced, which are always the first.
+        if (max_depth <= 0)
+            return work.size();
+
+        static thread_local path_pool pool;
+        static thread_local shadow_queue shadows;
+        pool.reset(size_t(std::max(1, wavefront_paths)));
+
+        std::vector<uint32_t> active, shading, sorted, finished, shadow_order, scratch;
+        std::vector<uint64_t> ray_keys;
+        node_visit_log visit_log;
+        auto scene_bounds = world.bounding_box();
+        size_t next_item = 0;
+        bool timed = deadline != render_clock::time_point::max();
+        bool out_of_time = false;
+
+        for (;;) {
+            // Paths still going after the last shade stage lead the queue, ahead of the
+            // camera paths generated next.
+            auto bounce_count = active.size();
+
+            if (timed && next_item < work.size() && render_clock::now() >= deadline)
+                out_of_time = true;
+
+            // Generate: start a camera path in every free slot.
+            while (!out_of_time && next_item < work.size() && !pool.full()) {
+                const auto& item = work[next_item];
+                auto i = x0 + item.pixel % width;
+                auto j = y0 + item.pixel / width;
+                auto slot = pool.allocate();
+
+                begin_sample(i, j, item.sample);
+                pool.rays[slot] = get_ray(i, j, item.sample % sqrt_spp, item.sample / sqrt_spp);
+                pool.random[slot].save();
+                pool.throughput[slot] = color(1,1,1);
+                pool.radiance[slot] = color(0,0,0);
+                pool.bsdf_pdf[slot] = 0;
+                pool.depth[slot] = 0;
+                pool.sample[slot] = uint32_t(next_item++);
+                active.push_back(slot);
+            }
+
+            if (active.empty())
+                break;
+
+            // Bounce rays leave their surfaces in every direction, so the extend stage takes
+            // them sorted by direction octant, or binned by octant and origin with sort_rays;
+            // rays next to each other in the queue then tend to walk the same BVH nodes.
+            // Camera rays follow in pixel order, which is coherent already.
+            if (sort_rays)
+                sort_by_ray_bin(active.begin(), active.begin() + bounce_count, pool.rays,
+                                scene_bounds, ray_keys);
+            else
+                sort_by_octant(active.begin(), active.begin() + bounce_count, pool.rays, scratch);
+
+            // Extend: find every path's closest hit.
+            for (size_t k = 0; k < active.size(); k++) {
+                auto slot = active[k];
+                bool measured = stats && k < bounce_count;
+                if (stats)
+                    node_visit_log::attached() = measured ? &visit_log : nullptr;
+
+                pool.random[slot].restore();
+                pool.hits[slot] = world.hit(pool.rays[slot], interval(0.001, infinity), pool.recs[slot]);
+                pool.random[slot].save();
+
+                if (measured && ((k + 1) % coherence_batch == 0 || k + 1 == bounce_count))
+                    stats->add_batch(k % coherence_batch + 1, visit_log);
+            }
+            if (stats)
+                node_visit_log::attached() = nullptr;
+
+            // Shade: misses gather the background and finish. Hits are shaded grouped by
+            // material, so each material's scatter code and textures run over a batch of paths.
+            shading.clear();
+            finished.clear();
+            for (auto slot : active) {
+                if (pool.hits[slot]) {
+                    shading.push_back(slot);
+                } else {
+                    pool.radiance[slot] += pool.throughput[slot] * background;
+                    finished.push_back(slot);
+                }
+            }
+
+            sort_by_material(shading, pool.recs, sorted);
+
+            active.clear();
+            shadows.clear();
+            for (auto slot : sorted) {
+                light_sample light;
+                pool.random[slot].restore();
+                bool alive = shade_vertex(
+                    pool.rays[slot], pool.recs[slot], pool.depth[slot], pool.throughput[slot],
+                    pool.radiance[slot], pool.bsdf_pdf[slot], &light, world, lights);
+                pool.random[slot].save();
+
+                if (light.test_visibility)
+                    shadows.push(light.shadow, light.max_t, light.contribution, slot, pool.random[slot]);
+
+                if (alive && ++pool.depth[slot] < max_depth)
+                    active.push_back(slot);
+                else
+                    finished.push_back(slot);
+            }
+
+            // Shadow: add each light sample that reaches its path, taking the rays by octant.
+            shadow_order.resize(shadows.size());
+            for (uint32_t k = 0; k < shadow_order.size(); k++)
+                shadow_order[k] = k;
+            sort_by_octant(shadow_order.begin(), shadow_order.end(), shadows.rays, scratch);
+
+            for (auto k : shadow_order) {
+                shadows.random[k].restore();
+                if (!world.occluded(shadows.rays[k], interval(0.001, shadows.max_t[k])))
+                    pool.radiance[shadows.path[k]] += shadows.contribution[k];
+            }
+
+            // Accumulate: hand back finished paths and free their slots for new camera rays.
+            for (auto slot : finished) {
+                results[pool.sample[slot]] = pool.radiance[slot];
+                pool.release(slot);
+            }
+        }
+
+        return next_item;
+    }
+
+    void add_sample(pixel_estimate& pixel, const color& sample) const {
+        pixel.sum += sample;
+        pixel.samples++;
+
+        if (adaptive) {
+            auto y = luminance(sample);
+            auto delta = y - pixel.mean;
+            pixel.mean += delta / pixel.samples;
+            pixel.m2 += delta * (y - pixel.mean);
+            pixel.converged = pixel.samples >= adaptive_min_samples
+                           && converged(pixel.mean, pixel.m2, pixel.samples);
+        }
+    }
+
+    std::vector<color> resolve(const std::vector<pixel_estimate>& film) const {
+        // The image so far: each pixel's sample mean, black where no sample was taken yet.
+        std::vector<color> color_buffer(film.size());
+        for (size_t p = 0; p < film.size(); p++) {
+            if (film[p].samples > 0)
+                color_buffer[p] = (1.0 / film[p].samples) * film[p].sum;
+        }
+        return color_buffer;
+    }
+
+    void report_coherence(const coherence_stats& stats) const {
+        // Logs how much of the BVH the bounce rays of a wavefront render share, per batch.
+        if (stats.batches == 0)
+            return;
+        std::clog << "\nBounce rays: " << stats.rays << " in batches of " << coherence_batch
+                  << (sort_rays ? ", binned" : ", by octant") << ": "
+                  << double(stats.unique_nodes) / stats.batches << " unique BVH nodes per batch, "
+                  << double(stats.node_visits) / stats.rays << " node visits per ray\n";
+    }
+
+    bool converged(double mean, double m2, int samples) const {
+        // True once the standard error of the pixel mean is within adaptive_threshold of the
+        // mean. Means below a dark floor are compared against the floor instead, so noise in
+        // nearly black pixels doesn't keep them sampling.
+        auto variance = m2 / (samples - 1);
+        auto standard_error = std::sqrt(variance / samples);
+        return standard_error <= adaptive_threshold * std::fmax(mean, adaptive_black_level);
+    }
+
+    double relative_noise(const pixel_estimate& pixel) const {
+        // Standard error of the pixel mean relative to the mean, on the same dark floor as
+        // converged(). Infinite until the pixel has two samples.
+        if (pixel.samples < 2)
+            return infinity;
+        auto standard_error = std::sqrt(pixel.m2 / (pixel.samples - 1) / pixel.samples);
+        return standard_error / std::fmax(pixel.mean, adaptive_black_level);
+    }
+
+    void report_samples(const std::vector<pixel_estimate>& film) const {
+        // Logs the average samples per pixel, and writes the sample count heatmap if asked:
+        // blue pixels stopped at adaptive_min_samples, red ones used the full budget.
+        auto budget = sqrt_spp * sqrt_spp;
+        double total = 0;
+        for (const auto& pixel : film)
+            total += pixel.samples;
+
+        std::clog << "\nAdaptive sampling: " << total / film.size()
+                  << " samples per pixel on average, of " << budget;
+        if (adaptive_budget > 0)
+            std::clog << " (budget " << std::fmax(adaptive_budget, adaptive_min_samples) << ")";
+        std::clog << "\n";
+
+        if (heatmap_file.empty())
+            return;
+
+        auto lowest = std::min(adaptive_min_samples, budget);
+        std::vector<unsigned char> image(film.size() * 3);
+        for (size_t p = 0; p < film.size(); p++) {
+            auto t = (budget > lowest) ? double(film[p].samples - lowest) / (budget - lowest) : 1.0;
+            t = std::fmin(1.0, std::fmax(0.0, t));
+
+            // Blue through green to red.
+            auto r = std::fmax(0.0, 2*t - 1);
+            auto g = 1 - std::fabs(2*t - 1);
+            auto b = std::fmax(0.0, 1 - 2*t);
+            image[3*p]     = (unsigned char)(255.999 * r);
+            image[3*p + 1] = (unsigned char)(255.999 * g);
+            image[3*p + 2] = (unsigned char)(255.999 * b);
+        }
+
+        if (stbi_write_png(heatmap_file.c_str(), image_width, image_height, 3, image.data(), image_width * 3))
+            std::clog << "Saved sample heatmap to: " << heatmap_file << "\n";
+        else
+            std::cerr << "Error: Failed to write PNG file " << heatmap_file << "\n";
+    }
 
     void initialize() {
         image_height = int(image_width / aspect_ratio);
         image_height = (image_height < 1) ? 1 : image_height;
 
         sqrt_spp = int(std::sqrt(samples_per_pixel));
-        pixel_samples_scale = 1.0 / (sqrt_spp * sqrt_spp);
         recip_sqrt_spp = 1.0 / sqrt_spp;
 
+        sample_source = make_sampler(sampler_type);
+        use_nee = (integrator == "nee");
+
+        // Adaptive and progressive rendering may stop after any sample, so sub-pixel strata
+        // filled in order would leave part of the pixel unsampled. They take offsets from the
+        // sampler instead.
+        stratify_pixels = sample_source->stratifies_pixel() && !adaptive && !progressive;
+
         center = lookfrom;
 
         // Determine viewport dimensions.
@@ -188,18 +987,28 @@ class camera {
         defocus_disk_v = v * defocus_radius;
     }
 
+    void begin_sample(int i, int j, int sample_index) const {
+        // Seeds the thread's random generator and sample stream for one sample of pixel i, j.
+        auto pixel = uint64_t(j) * image_width + i;
+        seed_thread_rng(pixel, sample_index, frame);
+        start_pixel_sample(sample_source.get(), pixel, sample_index, frame);
+    }
+
     ray get_ray(int i, int j, int s_i, int s_j) const {
         // Construct a camera ray originating from the defocus disk and directed at a randomly
         // sampled point around the pixel location i, j for stratified sample square s_i, s_j.
+        // Low-discrepancy samplers supply the sub-pixel position themselves.
 
-        auto offset = sample_square_stratified(s_i, s_j);
+        auto offset = stratify_pixels
+                    ? sample_square_stratified(s_i, s_j)
+                    : sample_square();
         auto pixel_sample = pixel00_loc
                           + ((i + offset.x()) * pixel_delta_u)
                           + ((j + offset.y()) * pixel_delta_v);
 
         auto ray_origin = (defocus_angle <= 0) ? center : defocus_disk_sample();        
         auto ray_direction = pixel_sample - ray_origin;
-        auto ray_time = random_double();
+        auto ray_time = sample_1d();
 
         return ray(ray_origin, ray_direction, ray_time);
     }
@@ -208,58 +1017,207 @@ class camera {
         // Returns the vector to a random point in the square sub-pixel specified by grid
         // indices s_i and s_j, for an idealized unit square pixel [-.5,-.5] to [+.5,+.5].
 
-        auto px = ((s_i + random_double()) * recip_sqrt_spp) - 0.5;
-        auto py = ((s_j + random_double()) * recip_sqrt_spp) - 0.5;
+        auto px = ((s_i + sample_1d()) * recip_sqrt_spp) - 0.5;
+        auto py = ((s_j + sample_1d()) * recip_sqrt_spp) - 0.5;
 
         return vec3(px, py, 0);
     }
 
     vec3 sample_square() const {
         // Returns the vector to a random point in the [-.5,-.5]-[+.5,+.5] unit square.
-        return vec3(random_double() - 0.5, random_double() - 0.5, 0);
+        auto s = sample_2d();
+        return vec3(s.x() - 0.5, s.y() - 0.5, 0);
     }
 
     point3 defocus_disk_sample() const {
         // Returns a random point in the camera defocus disk.
-        auto p = random_in_unit_disk();
+        auto s = sample_2d();
+        auto p = unit_disk_from_square(s.x(), s.y());
         return center + (p[0] * defocus_disk_u) + (p[1] * defocus_disk_v);
     }
 
-    color ray_color(const ray& r, int depth, const hittable& world, const hittable& lights)
-    const {
-        // If we've exceeded the ray bounce limit, no more light is gathered.
-        if (depth <= 0)
-            return color(0,0,0);
-
+    color ray_color(const ray& camera_ray, const hittable& world, const hittable& lights) const {
         hit_record rec;
+        bool hit = world.hit(camera_ray, interval(0.001, infinity), rec);
+        return ray_color(camera_ray, hit, rec, world, lights);
+    }
+
+    color ray_color(
+        const ray& camera_ray, bool hit, hit_record rec, const hittable& world, const hittable& lights
+    ) const {
+        // Follows one path from the camera for up to max_depth rays, carrying the product of
+        // the scattering weights so far (throughput) and the light gathered so far (radiance).
+
+        //
+        // The "nee" integrator also traces a shadow ray to a light sample at every vertex that
+        // samples a pdf, and weights the two ways of reaching a light (light sampling, and a
+        // BSDF-sampled ray that happens to hit it) with the power heuristic.
 
-        // If the ray hits nothing, return the background color.
-        if (!world.hit(r, interval(0.001, infinity), rec))
-            return background;
+        color radiance(0,0,0);
+        color throughput(1,1,1);
+        ray r = camera_ray;
+        double bsdf_pdf = 0;  // Density of the BSDF sample that produced r; 0 if not sampled
+
+        for (int depth = 0; depth < max_depth; depth++) {
+            // The camera ray's hit (hit and rec) comes from the caller; later rays are traced here.
+            if (depth > 0)
+                hit = world.hit(r, interval(0.001, infinity), rec);
+
+            // If the ray hits nothing, gather the background color.
+            if (!hit) {
+                radiance += throughput * background;
+                break;
+            }
+
+            if (!shade_vertex(r, rec, depth, throughput, radiance, bsdf_pdf, nullptr, world, lights))
+                break;
+        }
+
+        return radiance;
+    }
+
+    class light_sample {
+      // A next-event estimate at a path vertex: the light that arrives along shadow, already
+      // scaled by the path throughput. If test_visibility is set, it only arrives when
+      // nothing lies along shadow before max_t.
+      public:
+        bool   test_visibility = false;
+        ray    shadow;
+        double max_t = 0;
+        color  contribution;
+    };
+
+    bool shade_vertex(
+        ray& r, const hit_record& rec, int depth, color& throughput, color& radiance,
+        double& bsdf_pdf, light_sample* deferred_light, const hittable& world, const hittable& lights
+    ) const {
+        // Adds the light leaving the hit at the end of r to radiance, then scatters r onward
+        // from it and updates throughput and bsdf_pdf. Returns false if the path ends here.
+        // Given deferred_light, a light sample that needs a shadow ray is left there instead
+        // of being traced, and its light isn't yet in radiance.
 
         scatter_record srec;
-        color color_from_emission = rec.mat->emitted(r, rec, rec.u, rec.v, rec.p);
+        auto mat = material_table::get(rec.mat_id);
+        auto emitted = mat->emitted(r, rec, rec.u, rec.v, rec.p);
+
+        // Light that the previous vertex's light sample could also have reached.
+        if (use_nee && bsdf_pdf > 0 && !emitted.near_zero())
+            emitted *= power_heuristic(bsdf_pdf, lights.pdf_value(r.origin(), r.direction()));
 
-        if (!rec.mat->scatter(r, rec, srec))
-            return color_from_emission;
+        radiance += throughput * emitted;
+
+        if (!mat->scatter(r, rec, srec))
+            return false;
 
         if (srec.skip_pdf) {
-            return srec.attenuation * ray_color(srec.skip_pdf_ray, depth-1, world, lights);
+            throughput = throughput * srec.attenuation;
+            r = srec.skip_pdf_ray;
+            bsdf_pdf = 0;
+        } else if (use_nee) {
+            light_sample light;
+            if (sample_light(r, rec, srec, *mat, world, lights, light)) {
+                light.contribution = throughput * light.contribution;
+                if (light.test_visibility && deferred_light)
+                    *deferred_light = light;
+                else if (!light.test_visibility
+                         || !world.occluded(light.shadow, interval(0.001, light.max_t)))
+                    radiance += light.contribution;
+            }
+
+            const pdf& bsdf = srec.pdf_ref();
+            ray scattered = ray(rec.p, bsdf.generate(), r.time());
+            bsdf_pdf = bsdf.value(scattered.direction());
+            if (bsdf_pdf <= 0)
+                return false;
+
+            double scattering_pdf = mat->scattering_pdf(r, rec, scattered);
+
+            throughput = throughput * srec.attenuation * scattering_pdf / bsdf_pdf;
+            r = scattered;
+        } else {
+            hittable_pdf light_pdf(lights, rec.p);
+            mixture_pdf p(light_pdf, srec.pdf_ref());
+
+            ray scattered = ray(rec.p, p.generate(), r.time());
+            auto pdf_value = p.value(scattered.direction());
+
+            double scattering_pdf = mat->scattering_pdf(r, rec, scattered);
+
+            throughput = throughput * srec.attenuation * scattering_pdf / pdf_value;
+            r = scattered;
+        }
+
+        // Russian roulette: past the first few bounces, end the path with a probability
+        // that grows as its throughput falls, and boost survivors to stay unbiased.
+        if (russian_roulette && depth + 1 >= roulette_depth) {
+            auto survival = std::fmin(1.0,
+                std::fmax(throughput.x(), std::fmax(throughput.y(), throughput.z())));
+            if (random_double() >= survival)
+                return false;
+            throughput /= survival;
         }
 
-        auto light_ptr = make_shared<hittable_pdf>(lights, rec.p);
-        mixture_pdf p(light_ptr, srec.pdf_ptr);
+        return true;
+    }
+
+    bool sample_light(
+        const ray& r_in, const hit_record& rec, const scatter_record& srec, const material& mat,
+        const hittable& world, const hittable& lights, light_sample& light
+    ) const {
+        // Next-event estimation: the light reaching rec.p along a direction sampled from the
+        // lights, scaled by the BSDF and weighted against sampling the same direction from it.
+        // Returns false if the sample can't contribute. The caller tests visibility.
+
+        ray shadow(rec.p, lights.random(rec.p), r_in.time());
+        auto light_pdf = lights.pdf_value(rec.p, shadow.direction());
+        if (light_pdf <= 0)
+            return false;
+
+        auto scattering_pdf = mat.scattering_pdf(r_in, rec, shadow);
+        if (scattering_pdf <= 0)
+            return false;
+
+        // Find the sampled light along the shadow ray; the caller then tests only whether
+        // anything in the world lies in front of it. Hand-built light lists have no
+        // materials; for those, the light is reached if the first surface in the world emits.
+        hit_record light_rec;
+        if (!lights.hit(shadow, interval(0.001, infinity), light_rec))
+            return false;
+
+        auto light_mat = material_table::get(light_rec.mat_id);
+        bool hand_built = !light_mat;
+        if (hand_built) {
+            if (!world.hit(shadow, interval(0.001, infinity), light_rec))
+                return false;
+            light_mat = material_table::get(light_rec.mat_id);
+        }
+
+        auto emitted = light_mat->emitted(shadow, light_rec, light_rec.u, light_rec.v, light_rec.p);
+        if (emitted.near_zero())
+            return false;
+
+        auto weight = power_heuristic(light_pdf, srec.pdf_ref().value(shadow.direction()));
+        light.test_visibility = !hand_built;
+        light.shadow = shadow;
+        light.max_t = light_rec.t * (1 - shadow_epsilon);
+        light.contribution = srec.attenuation * scattering_pdf * emitted * weight / light_pdf;
+        return true;
+    }
 
-        ray scattered = ray(rec.p, p.generate(), r.time());
-        auto pdf_value = p.value(scattered.direction());
+    // Bounce rays per batch when ray_stats counts the BVH nodes a batch visits.
+    static constexpr size_t coherence_batch = 64;
 
-        double scattering_pdf = rec.mat->scattering_pdf(r, rec, scattered);
+    // Pixels darker than this luminance are held to the same absolute error as this level.
+    static constexpr double adaptive_black_level = 0.01;
 
-        color sample_color = ray_color(scattered, depth-1, world, lights);
-        color color_from_scatter =
-            (srec.attenuation * scattering_pdf * sample_color) / pdf_value;
+    // Shadow rays stop this fraction short of the light, so they don't hit the light itself.
+    static constexpr double shadow_epsilon = 1e-6;
 
-        return color_from_emission + color_from_scatter;
+    static double power_heuristic(double pdf_f, double pdf_g) {
+        // MIS weight of a sample drawn from f, when g could also have drawn it.
+        auto f2 = pdf_f * pdf_f;
+        auto g2 = pdf_g * pdf_g;
+        return f2 / (f2 + g2);
     }
 };
 
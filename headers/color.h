@@ -8,6 +8,11 @@
 
 using color = vec3;
 
+inline double luminance(const color& c) {
+    // Relative luminance of a linear RGB color (Rec. 709 weights).
+    return 0.2126*c.x() + 0.7152*c.y() + 0.0722*c.z();
+}
+
 inline double linear_to_gamma(double linear_component)
 {
     if (linear_component > 0)
@@ -9,21 +9,22 @@ class constant_medium : public hittable {
   public:
     constant_medium(shared_ptr<hittable> boundary, double density, shared_ptr<texture> tex)
       : boundary(boundary), neg_inv_density(-1/density),
-        phase_function(make_shared<isotropic>(tex))
+        phase_function(material_table::add(make_shared<isotropic>(tex)))
     {}
 
     constant_medium(shared_ptr<hittable> boundary, double density, const color& albedo)
       : boundary(boundary), neg_inv_density(-1/density),
-        phase_function(make_shared<isotropic>(albedo))
+        phase_function(material_table::add(make_shared<isotropic>(albedo)))
     {}
 
-    bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+    bool intersect(const ray& r, interval ray_t, hit_record& rec) const override {
+        // The scattering distance is random, so the whole record is filled in here.
         hit_record rec1, rec2;
 
-        if (!boundary->hit(r, interval::universe, rec1))
+        if (!boundary->intersect(r, interval::universe, rec1))
             return false;
 
-        if (!boundary->hit(r, interval(rec1.t+0.0001, infinity), rec2))
+        if (!boundary->intersect(r, interval(rec1.t+0.0001, infinity), rec2))
             return false;
 
         if (rec1.t < ray_t.min) rec1.t = ray_t.min;
@@ -47,7 +48,8 @@ class constant_medium : public hittable {
 
         rec.normal = vec3(1,0,0);  // arbitrary
         rec.front_face = true;     // also arbitrary
-        rec.mat = phase_function;
+        rec.mat_id = phase_function;
+        rec.object = this;
 
         return true;
     }
@@ -57,7 +59,7 @@ class constant_medium : public hittable {
   private:
     shared_ptr<hittable> boundary;
     double neg_inv_density;
-    shared_ptr<material> phase_function;
+    uint32_t phase_function;  // Material table id
 };
 
 #endif
\ No newline at end of file
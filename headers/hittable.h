@@ -3,19 +3,115 @@
 
 #include "ray.h"
 #include "aabb.h"
+#include "ray_packet.h"
+
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
 
 class material;
 
+class material_table {
+  // Scene-wide registry of materials. Primitives register their material when they are built
+  // and keep only its 32-bit id, and hit records carry that id, so ray intersection never
+  // touches a reference count. Id 0 stands for no material. Registering the same material
+  // again returns its existing id.
+  //
+  // get() reads without the lock, so the table must not change while a render runs: cameras
+  // hold a freeze_guard for the length of each render, and add() or clear() under a guard
+  // reports an error and aborts, in every build.
+  public:
+    static uint32_t add(shared_ptr<material> mat) {
+        if (!mat)
+            return 0;
+
+        auto& table = instance();
+        std::lock_guard<std::mutex> lock(table.mutex);
+        table.check_unfrozen("add");
+
+        auto found = table.ids.find(mat.get());
+        if (found != table.ids.end())
+            return found->second;
+
+        auto id = uint32_t(table.materials.size());
+        table.materials.push_back(mat);
+        table.ids.emplace(mat.get(), id);
+        return id;
+    }
+
+    static const material* get(uint32_t id) {
+        return instance().materials[id].get();
+    }
+
+    static void clear() {
+        // Releases every registered material, for programs that build one scene after
+        // another. Ids handed out before are invalid afterwards, so the primitives holding
+        // them must be gone too.
+        auto& table = instance();
+        std::lock_guard<std::mutex> lock(table.mutex);
+        table.check_unfrozen("clear");
+
+        table.materials.assign(1, nullptr);
+        table.ids.clear();
+    }
+
+    class freeze_guard {
+      // Marks the table read-only while it exists.
+      public:
+        freeze_guard() {
+            auto& table = instance();
+            std::lock_guard<std::mutex> lock(table.mutex);
+            table.freeze_count++;
+        }
+
+        ~freeze_guard() {
+            auto& table = instance();
+            std::lock_guard<std::mutex> lock(table.mutex);
+            table.freeze_count--;
+        }
+
+        freeze_guard(const freeze_guard&) = delete;
+        freeze_guard& operator=(const freeze_guard&) = delete;
+    };
+
+  private:
+    std::vector<shared_ptr<material>> materials{ nullptr };
+    std::unordered_map<const material*, uint32_t> ids;
+    std::mutex mutex;
+    int freeze_count = 0;  // Live freeze_guards; guarded by mutex
+
+    static material_table& instance() {
+        static material_table table;
+        return table;
+    }
+
+    void check_unfrozen(const char* operation) const {
+        // A change now could reallocate the vector under a render's unlocked reads.
+        if (freeze_count > 0) {
+            std::cerr << "Error: material_table::" << operation << "() called during a render\n";
+            std::abort();
+        }
+    }
+};
+
 class hit_record {
   public:
     point3 p;
     vec3 normal;
-    shared_ptr<material> mat;
+    uint32_t mat_id;  // Index into material_table
     double t;
     double u;
     double v;
     bool front_face;
 
+    // Set by intersect() for the closest hit so far; finalize() derives the fields above.
+    const class hittable* object;  // The object whose finalize() completes the record
+    uint32_t prim_id;              // Primitive within the object, such as a mesh triangle
+    double b1, b2;                 // Barycentric coordinates of the hit on that primitive
+
     void set_face_normal(const ray& r, const vec3& outward_normal) {
         // Sets the hit record normal vector.
         // NOTE: the parameter `outward_normal` is assumed to have unit length.
@@ -25,11 +121,65 @@ class hit_record {
     }
 };
 
+class hittable;
+
+class emitter {
+  // An emitting primitive found in the scene, placed where it sits in the world, and the
+  // total power it sends out.
+  public:
+    shared_ptr<hittable> object;
+    double power;
+};
+
 class hittable {
   public:
     virtual ~hittable() = default;
 
-    virtual bool hit(const ray& r, interval ray_t, hit_record& rec) const = 0;
+    bool hit(const ray& r, interval ray_t, hit_record& rec) const {
+        // Finds the closest hit in ray_t and fills in the whole hit record for it.
+        if (!intersect(r, ray_t, rec))
+            return false;
+        rec.object->finalize(r, rec);
+        return true;
+    }
+
+    // Finds the closest hit in ray_t, recording only t, object, prim_id and the barycentrics.
+    // Traversal calls this for every candidate, so it defers everything else, and it leaves
+    // rec untouched when there is no hit.
+    virtual bool intersect(const ray& r, interval ray_t, hit_record& rec) const = 0;
+
+    // Completes the record of a hit that intersect() found on this object: the point, normal,
+    // front_face, material and texture coordinates. Runs once per ray, for the winning hit.
+    // Objects that fill in the whole record during intersect() keep this default.
+    virtual void finalize(const ray&, hit_record&) const {}
+
+    // Returns whether the ray hits anything in ray_t. Aggregates stop at the first hit they
+    // find rather than the closest, which is all a shadow or visibility ray needs.
+    virtual bool occluded(const ray& r, interval ray_t) const {
+        hit_record rec;
+        return intersect(r, ray_t, rec);
+    }
+
+    // intersect() for the packet lanes in mask: every lane hit gets its record filled in as
+    // intersect() would, and its t_max lowered to the hit. Returns the lanes hit. This
+    // default traces the lanes one at a time; spheres, quads, lists, BVHs and transforms
+    // test all lanes together.
+    virtual uint32_t intersect_packet(ray_packet& packet, uint32_t mask, hit_record recs[]) const {
+        uint32_t hits = 0;
+        for (int k = 0; k < ray_packet::size; k++) {
+            if (!(mask & ray_packet::lane_bit(k)))
+                continue;
+            if (packet.lane_random)
+                packet.lane_random[k].restore();
+            if (intersect(packet.lane_ray(k), interval(packet.t_min[k], packet.t_max[k]), recs[k])) {
+                packet.t_max[k] = recs[k].t;
+                hits |= ray_packet::lane_bit(k);
+            }
+            if (packet.lane_random)
+                packet.lane_random[k].save();
+        }
+        return hits;
+    }
 
     virtual aabb bounding_box() const = 0;
 
@@ -40,6 +190,19 @@ class hittable {
     virtual vec3 random(const point3& origin) const {
         return vec3(1,0,0);
     }
+
+    // Appends every emitting primitive in this object to lights. self is the caller's own
+    // pointer to this object (null at the top level), which a primitive adds if it emits.
+    // Aggregates pass each child's pointer down; transforms wrap what their child finds.
+    virtual void gather_emitters(const shared_ptr<hittable>& self, std::vector<emitter>& lights)
+    const {
+        auto power = emitted_power();
+        if (self && power > 0)
+            lights.push_back(emitter{self, power});
+    }
+
+    // Total power the object emits, if it is a primitive that can be sampled as a light.
+    virtual double emitted_power() const { return 0; }
 };
 
 class translate : public hittable {
@@ -50,7 +213,10 @@ class translate : public hittable {
         bbox = object->bounding_box() + offset;
     }
 
-    bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+    bool intersect(const ray& r, interval ray_t, hit_record& rec) const override {
+        // The inner hit is finalized here, in object space, as the record must be moved into
+        // world space before the caller sees it.
+
         // Move the ray backwards by the offset
         ray offset_r(r.origin() - offset, r.direction(), r.time());
 
@@ -60,12 +226,53 @@ class translate : public hittable {
 
         // Move the intersection point forwards by the offset
         rec.p += offset;
+        rec.object = this;
 
         return true;
     }
 
+    bool occluded(const ray& r, interval ray_t) const override {
+        return object->occluded(ray(r.origin() - offset, r.direction(), r.time()), ray_t);
+    }
+
+    uint32_t intersect_packet(ray_packet& packet, uint32_t mask, hit_record recs[]) const override {
+        ray_packet offset_packet = packet;
+        for (int axis = 0; axis < 3; axis++) {
+            for (int k = 0; k < ray_packet::size; k++)
+                offset_packet.org[axis][k] = packet.org[axis][k] - offset[axis];
+        }
+
+        auto hits = object->intersect_packet(offset_packet, mask, recs);
+        for (int k = 0; k < ray_packet::size; k++) {
+            if (hits & ray_packet::lane_bit(k)) {
+                recs[k].object->finalize(offset_packet.lane_ray(k), recs[k]);
+                recs[k].p += offset;
+                recs[k].object = this;
+                packet.t_max[k] = recs[k].t;
+            }
+        }
+        return hits;
+    }
+
     aabb bounding_box() const override { return bbox; }
 
+    double pdf_value(const point3& origin, const vec3& direction) const override {
+        return object->pdf_value(origin - offset, direction);
+    }
+
+    vec3 random(const point3& origin) const override {
+        return object->random(origin - offset);
+    }
+
+    void gather_emitters(const shared_ptr<hittable>&, std::vector<emitter>& lights)
+    const override {
+        // Each light inside gets its own translate, so it can be sampled on its own.
+        std::vector<emitter> inner;
+        object->gather_emitters(object, inner);
+        for (const auto& light : inner)
+            lights.push_back(emitter{make_shared<translate>(light.object, offset), light.power});
+    }
+
   private:
     shared_ptr<hittable> object;
     vec3 offset;
@@ -74,7 +281,7 @@ class translate : public hittable {
 
 class rotate_y : public hittable {
   public:
-    rotate_y(shared_ptr<hittable> object, double angle) : object(object) {
+    rotate_y(shared_ptr<hittable> object, double angle) : object(object), angle(angle) {
         auto radians = degrees_to_radians(angle);
         sin_theta = std::sin(radians);
         cos_theta = std::cos(radians);
@@ -106,23 +313,12 @@ class rotate_y : public hittable {
         bbox = aabb(min, max);
     }
 
-    bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+    bool intersect(const ray& r, interval ray_t, hit_record& rec) const override {
+        // Like translate, finalizes the inner hit eagerly.
 
         // Transform the ray from world space to object space.
 
-        auto origin = point3(
-            (cos_theta * r.origin().x()) - (sin_theta * r.origin().z()),
-            r.origin().y(),
-            (sin_theta * r.origin().x()) + (cos_theta * r.origin().z())
-        );
-
-        auto direction = vec3(
-            (cos_theta * r.direction().x()) - (sin_theta * r.direction().z()),
-            r.direction().y(),
-            (sin_theta * r.direction().x()) + (cos_theta * r.direction().z())
-        );
-
-        ray rotated_r(origin, direction, r.time());
+        ray rotated_r(to_object(r.origin()), to_object(r.direction()), r.time());
 
         // Determine whether an intersection exists in object space (and if so, where).
 
@@ -131,28 +327,79 @@ class rotate_y : public hittable {
 
         // Transform the intersection from object space back to world space.
 
-        rec.p = point3(
-            (cos_theta * rec.p.x()) + (sin_theta * rec.p.z()),
-            rec.p.y(),
-            (-sin_theta * rec.p.x()) + (cos_theta * rec.p.z())
-        );
-
-        rec.normal = vec3(
-            (cos_theta * rec.normal.x()) + (sin_theta * rec.normal.z()),
-            rec.normal.y(),
-            (-sin_theta * rec.normal.x()) + (cos_theta * rec.normal.z())
-        );
+        rec.p = to_world(rec.p);
+        rec.normal = to_world(rec.normal);
 
+        rec.object = this;
         return true;
     }
 
+    bool occluded(const ray& r, interval ray_t) const override {
+        return object->occluded(ray(to_object(r.origin()), to_object(r.direction()), r.time()), ray_t);
+    }
+
+    uint32_t intersect_packet(ray_packet& packet, uint32_t mask, hit_record recs[]) const override {
+        ray_packet rotated_packet = packet;
+        for (int k = 0; k < ray_packet::size; k++) {
+            rotated_packet.set(k, ray(to_object(packet.lane_ray(k).origin()),
+                                      to_object(packet.lane_ray(k).direction()), packet.time[k]),
+                               interval(packet.t_min[k], packet.t_max[k]));
+        }
+
+        auto hits = object->intersect_packet(rotated_packet, mask, recs);
+        for (int k = 0; k < ray_packet::size; k++) {
+            if (hits & ray_packet::lane_bit(k)) {
+                recs[k].object->finalize(rotated_packet.lane_ray(k), recs[k]);
+                recs[k].p = to_world(recs[k].p);
+                recs[k].normal = to_world(recs[k].normal);
+                recs[k].object = this;
+                packet.t_max[k] = recs[k].t;
+            }
+        }
+        return hits;
+    }
+
     aabb bounding_box() const override { return bbox; }
 
+    double pdf_value(const point3& origin, const vec3& direction) const override {
+        return object->pdf_value(to_object(origin), to_object(direction));
+    }
+
+    vec3 random(const point3& origin) const override {
+        return to_world(object->random(to_object(origin)));
+    }
+
+    void gather_emitters(const shared_ptr<hittable>&, std::vector<emitter>& lights)
+    const override {
+        std::vector<emitter> inner;
+        object->gather_emitters(object, inner);
+        for (const auto& light : inner)
+            lights.push_back(emitter{make_shared<rotate_y>(light.object, angle), light.power});
+    }
+
   private:
     shared_ptr<hittable> object;
+    double angle;
     double sin_theta;
     double cos_theta;
     aabb bbox;
+
+    vec3 to_object(const vec3& v) const {
+        // Rotates a world-space point or vector into object space.
+        return vec3(
+            (cos_theta * v.x()) - (sin_theta * v.z()),
+            v.y(),
+            (sin_theta * v.x()) + (cos_theta * v.z())
+        );
+    }
+
+    vec3 to_world(const vec3& v) const {
+        return vec3(
+            (cos_theta * v.x()) + (sin_theta * v.z()),
+            v.y(),
+            (-sin_theta * v.x()) + (cos_theta * v.z())
+        );
+    }
 };
 
 #endif
\ No newline at end of file
@@ -4,6 +4,7 @@
 #include "aabb.h"
 #include "hittable.h"
 
+#include <algorithm>
 #include <memory>
 #include <vector>
 
@@ -24,22 +25,37 @@ class hittable_list : public hittable {
         bbox = aabb(bbox, object->bounding_box());
     }
 
-    bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
-        hit_record temp_rec;
+    bool intersect(const ray& r, interval ray_t, hit_record& rec) const override {
+        // Objects only write the record on a hit, so each closer hit overwrites the last.
         bool hit_anything = false;
         auto closest_so_far = ray_t.max;
 
         for (const auto& object : objects) {
-            if (object->hit(r, interval(ray_t.min, closest_so_far), temp_rec)) {
+            if (object->intersect(r, interval(ray_t.min, closest_so_far), rec)) {
                 hit_anything = true;
-                closest_so_far = temp_rec.t;
-                rec = temp_rec;
+                closest_so_far = rec.t;
             }
         }
 
         return hit_anything;
     }
 
+    uint32_t intersect_packet(ray_packet& packet, uint32_t mask, hit_record recs[]) const override {
+        // Each object sees the lanes' t_max lowered by the hits before it, as in intersect().
+        uint32_t hits = 0;
+        for (const auto& object : objects)
+            hits |= object->intersect_packet(packet, mask, recs);
+        return hits;
+    }
+
+    bool occluded(const ray& r, interval ray_t) const override {
+        for (const auto& object : objects) {
+            if (object->occluded(r, ray_t))
+                return true;
+        }
+        return false;
+    }
+
     aabb bounding_box() const override { return bbox; }
 
     double pdf_value(const point3& origin, const vec3& direction) const override {
@@ -52,9 +68,16 @@ class hittable_list : public hittable {
         return sum;
     }
 
+    void gather_emitters(const shared_ptr<hittable>&, std::vector<emitter>& lights)
+    const override {
+        for (const auto& object : objects)
+            object->gather_emitters(object, lights);
+    }
+
     vec3 random(const point3& origin) const override {
         auto int_size = int(objects.size());
-        return objects[random_int(0, int_size-1)]->random(origin);
+        auto index = std::min(int(sample_1d() * int_size), int_size-1);
+        return objects[index]->random(origin);
     }
 
   private:
@@ -0,0 +1,218 @@
+#ifndef INSTANCE_H
+#define INSTANCE_H
+
+#include "hittable.h"
+#include "linear_bvh.h"
+
+#include <vector>
+
+class affine_transform {
+  // A 3x4 affine transform: a 3x3 linear part in the first three columns and a translation in
+  // the fourth. Points transform as M*p + t; vectors ignore the translation.
+  public:
+    double m[3][4];
+
+    affine_transform() : m{{1,0,0,0}, {0,1,0,0}, {0,0,1,0}} {}
+
+    static affine_transform translation(const vec3& offset) {
+        affine_transform xf;
+        for (int row = 0; row < 3; row++)
+            xf.m[row][3] = offset[row];
+        return xf;
+    }
+
+    static affine_transform scaling(const vec3& scale) {
+        affine_transform xf;
+        for (int row = 0; row < 3; row++)
+            xf.m[row][row] = scale[row];
+        return xf;
+    }
+
+    static affine_transform rotation(const vec3& axis, double angle) {
+        // Rotation by angle degrees around the given axis (Rodrigues' formula), right-handed,
+        // so rotation(vec3(0,1,0), a) matches rotate_y(object, a).
+        auto a = unit_vector(axis);
+        auto radians = degrees_to_radians(angle);
+        auto c = std::cos(radians), s = std::sin(radians), k = 1 - c;
+
+        affine_transform xf;
+        xf.m[0][0] = c + a.x()*a.x()*k;
+        xf.m[0][1] = a.x()*a.y()*k - a.z()*s;
+        xf.m[0][2] = a.x()*a.z()*k + a.y()*s;
+        xf.m[1][0] = a.y()*a.x()*k + a.z()*s;
+        xf.m[1][1] = c + a.y()*a.y()*k;
+        xf.m[1][2] = a.y()*a.z()*k - a.x()*s;
+        xf.m[2][0] = a.z()*a.x()*k - a.y()*s;
+        xf.m[2][1] = a.z()*a.y()*k + a.x()*s;
+        xf.m[2][2] = c + a.z()*a.z()*k;
+        return xf;
+    }
+
+    point3 apply_point(const point3& p) const {
+        return point3(
+            m[0][0]*p.x() + m[0][1]*p.y() + m[0][2]*p.z() + m[0][3],
+            m[1][0]*p.x() + m[1][1]*p.y() + m[1][2]*p.z() + m[1][3],
+            m[2][0]*p.x() + m[2][1]*p.y() + m[2][2]*p.z() + m[2][3]);
+    }
+
+    vec3 apply_vector(const vec3& v) const {
+        return vec3(
+            m[0][0]*v.x() + m[0][1]*v.y() + m[0][2]*v.z(),
+            m[1][0]*v.x() + m[1][1]*v.y() + m[1][2]*v.z(),
+            m[2][0]*v.x() + m[2][1]*v.y() + m[2][2]*v.z());
+    }
+
+    vec3 apply_transposed(const vec3& v) const {
+        // Multiplies by the transpose of the linear part. Applied on the inverse transform,
+        // this carries surface normals across.
+        return vec3(
+            m[0][0]*v.x() + m[1][0]*v.y() + m[2][0]*v.z(),
+            m[0][1]*v.x() + m[1][1]*v.y() + m[2][1]*v.z(),
+            m[0][2]*v.x() + m[1][2]*v.y() + m[2][2]*v.z());
+    }
+
+    affine_transform inverse() const {
+        // Inverts the linear part by cofactors; the translation becomes -inverse(M)*t.
+        affine_transform inv;
+        auto det = m[0][0]*(m[1][1]*m[2][2] - m[1][2]*m[2][1])
+                 - m[0][1]*(m[1][0]*m[2][2] - m[1][2]*m[2][0])
+                 + m[0][2]*(m[1][0]*m[2][1] - m[1][1]*m[2][0]);
+        auto inv_det = 1.0 / det;
+
+        inv.m[0][0] =  (m[1][1]*m[2][2] - m[1][2]*m[2][1]) * inv_det;
+        inv.m[0][1] = -(m[0][1]*m[2][2] - m[0][2]*m[2][1]) * inv_det;
+        inv.m[0][2] =  (m[0][1]*m[1][2] - m[0][2]*m[1][1]) * inv_det;
+        inv.m[1][0] = -(m[1][0]*m[2][2] - m[1][2]*m[2][0]) * inv_det;
+        inv.m[1][1] =  (m[0][0]*m[2][2] - m[0][2]*m[2][0]) * inv_det;
+        inv.m[1][2] = -(m[0][0]*m[1][2] - m[0][2]*m[1][0]) * inv_det;
+        inv.m[2][0] =  (m[1][0]*m[2][1] - m[1][1]*m[2][0]) * inv_det;
+        inv.m[2][1] = -(m[0][0]*m[2][1] - m[0][1]*m[2][0]) * inv_det;
+        inv.m[2][2] =  (m[0][0]*m[1][1] - m[0][1]*m[1][0]) * inv_det;
+
+        auto t = inv.apply_vector(vec3(m[0][3], m[1][3], m[2][3]));
+        for (int row = 0; row < 3; row++)
+            inv.m[row][3] = -t[row];
+        return inv;
+    }
+
+    aabb apply_box(const aabb& box) const {
+        // Returns the box enclosing all eight transformed corners of the given box.
+        point3 min( infinity,  infinity,  infinity);
+        point3 max(-infinity, -infinity, -infinity);
+
+        for (int i = 0; i < 2; i++) {
+            for (int j = 0; j < 2; j++) {
+                for (int k = 0; k < 2; k++) {
+                    auto corner = apply_point(point3(
+                        i ? box.x.max : box.x.min, j ? box.y.max : box.y.min, k ? box.z.max : box.z.min));
+                    for (int c = 0; c < 3; c++) {
+                        min[c] = std::fmin(min[c], corner[c]);
+                        max[c] = std::fmax(max[c], corner[c]);
+                    }
+                }
+            }
+        }
+
+        return aabb(min, max);
+    }
+};
+
+inline affine_transform operator*(const affine_transform& a, const affine_transform& b) {
+    // Composition: (a*b) applies b first, then a.
+    affine_transform xf;
+    for (int row = 0; row < 3; row++) {
+        for (int col = 0; col < 4; col++) {
+            xf.m[row][col] = a.m[row][0]*b.m[0][col] + a.m[row][1]*b.m[1][col] + a.m[row][2]*b.m[2][col];
+        }
+        xf.m[row][3] += a.m[row][3];
+    }
+    return xf;
+}
+
+class instance : public hittable {
+  // A placement of a shared object (typically a BVH, acting as the bottom-level structure)
+  // under an affine transform. Rays are carried into object space unnormalized, so hit
+  // distances stay valid in world space.
+  public:
+    instance(shared_ptr<hittable> object, const affine_transform& object_to_world)
+      : object(object), object_to_world(object_to_world),
+        world_to_object(object_to_world.inverse())
+    {
+        bbox = object_to_world.apply_box(object->bounding_box());
+    }
+
+    bool intersect(const ray& r, interval ray_t, hit_record& rec) const override {
+        // Finalizes the object's hit eagerly, to carry it back into world space.
+        ray object_r(world_to_object.apply_point(r.origin()),
+                     world_to_object.apply_vector(r.direction()), r.time());
+
+        if (!object->hit(object_r, ray_t, rec))
+            return false;
+
+        rec.p = object_to_world.apply_point(rec.p);
+        rec.normal = unit_vector(world_to_object.apply_transposed(rec.normal));
+        rec.object = this;
+
+        return true;
+    }
+
+    bool occluded(const ray& r, interval ray_t) const override {
+        ray object_r(world_to_object.apply_point(r.origin()),
+                     world_to_object.apply_vector(r.direction()), r.time());
+        return object->occluded(object_r, ray_t);
+    }
+
+    aabb bounding_box() const override { return bbox; }
+
+  private:
+    shared_ptr<hittable> object;
+    affine_transform object_to_world;
+    affine_transform world_to_object;
+    aabb bbox;
+};
+
+class tlas : public hittable {
+  // Top-level acceleration structure: a flat BVH over instances held by value. Each instance
+  // costs its two transforms, a box and a shared pointer, however large the object it places.
+  public:
+    tlas(const std::vector<instance>& placed) {
+        std::vector<aabb> bounds;
+        bounds.reserve(placed.size());
+        for (const auto& inst : placed) {
+            bounds.push_back(inst.bounding_box());
+            bbox = aabb(bbox, inst.bounding_box());
+        }
+
+        tree.build(bounds, 2);
+
+        instances.reserve(placed.size());
+        for (auto index : tree.prim_order)
+            instances.push_back(placed[index]);
+    }
+
+    bool intersect(const ray& r, interval ray_t, hit_record& rec) const override {
+        return tree.traverse(r, ray_t, [&](uint32_t slot, interval& t) {
+            if (!instances[slot].intersect(r, t, rec))
+                return false;
+            t.max = rec.t;
+            return true;
+        });
+    }
+
+    bool occluded(const ray& r, interval ray_t) const override {
+        return tree.traverse<true>(r, ray_t, [&](uint32_t slot, interval& t) {
+            return instances[slot].occluded(r, t);
+        });
+    }
+
+    aabb bounding_box() const override { return bbox; }
+
+    size_t instance_count() const { return instances.size(); }
+
+  private:
+    flat_bvh tree;
+    std::vector<instance> instances;  // In leaf slot order
+    aabb bbox;
+};
+
+#endif
@@ -0,0 +1,260 @@
+#ifndef LIGHT_SAMPLER_H
+#define LIGHT_SAMPLER_H
+
+#include "hittable.h"
+#include "hittable_list.h"
+#include "linear_bvh.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+enum class light_selection {
+    power,  // Pick lights in proportion to their power, from an alias table
+    bvh     // Descend a light BVH, favoring bright subtrees close to the shading point
+};
+
+class light_sampler : public hittable {
+  // A drop-in replacement for a hittable_list of lights, as the lights argument of
+  // camera::render. Instead of picking a light uniformly, it picks lights by power, either
+  // globally in O(1) from an alias table, or per shading point by walking a BVH built over
+  // the lights. Both pdf_value() and random() use a BVH over the light bounds, so pdf
+  // evaluation only visits the lights the direction actually passes through.
+  public:
+    light_sampler(
+        const hittable_list& list, std::vector<double> powers = {},
+        light_selection selection = light_selection::power
+    ) : selection(selection) {
+        // Powers are relative weights, one per light in the list. Missing powers default to 1.
+        powers.resize(list.objects.size(), 1.0);
+        build(list.objects, powers);
+    }
+
+    light_sampler(const std::vector<emitter>& emitters, light_selection selection = light_selection::power)
+      : selection(selection)
+    {
+        std::vector<shared_ptr<hittable>> objects;
+        std::vector<double> powers;
+        for (const auto& light : emitters) {
+            objects.push_back(light.object);
+            powers.push_back(light.power);
+        }
+        build(objects, powers);
+    }
+
+    bool intersect(const ray& r, interval ray_t, hit_record& rec) const override {
+        return tree.traverse(r, ray_t, [&](uint32_t slot, interval& t) {
+            if (!lights[slot]->intersect(r, t, rec))
+                return false;
+            t.max = rec.t;
+            return true;
+        });
+    }
+
+    bool occluded(const ray& r, interval ray_t) const override {
+        return tree.traverse<true>(r, ray_t, [&](uint32_t slot, interval& t) {
+            return lights[slot]->occluded(r, t);
+        });
+    }
+
+    aabb bounding_box() const override { return bbox; }
+
+    double pdf_value(const point3& origin, const vec3& direction) const override {
+        // Only lights that the direction hits have a nonzero pdf, so visit just those: the
+        // callback never reports a hit, which keeps every box along the ray in play.
+        double sum = 0;
+        tree.traverse(ray(origin, direction), interval(0.001, infinity), [&](uint32_t slot, interval&) {
+            auto light_pdf = lights[slot]->pdf_value(origin, direction);
+            if (light_pdf > 0)
+                sum += selection_pdf(slot, origin) * light_pdf;
+            return false;
+        });
+        return sum;
+    }
+
+    vec3 random(const point3& origin) const override {
+        if (lights.empty())
+            return vec3(1,0,0);
+        return lights[select(origin)]->random(origin);
+    }
+
+    size_t light_count() const { return lights.size(); }
+
+    double selection_pdf(uint32_t slot, const point3& origin) const {
+        // Probability that random(origin) picks the light in the given slot.
+        if (selection == light_selection::power)
+            return power[slot] / total_power;
+
+        double pmf = 1;
+        auto node = leaf_of_slot[slot];
+        while (node != 0) {
+            auto parent = parent_of_node[node];
+            auto p_first = first_child_probability(parent, origin);
+            pmf *= (node == parent + 1) ? p_first : 1 - p_first;
+            node = parent;
+        }
+        return pmf;
+    }
+
+  private:
+    light_selection selection;
+    flat_bvh tree;                            // Leaves hold one light each
+    std::vector<shared_ptr<hittable>> lights;  // In leaf slot order
+    std::vector<double> power;                // Per slot
+    double total_power = 0;
+    aabb bbox;
+
+    // Alias table (Vose): slot i is kept with probability alias_keep[i], else alias_slot[i].
+    std::vector<double>   alias_keep;
+    std::vector<uint32_t> alias_slot;
+
+    // Per BVH node: total power below it and its parent. Per slot: its leaf node.
+    std::vector<double>   node_power;
+    std::vector<uint32_t> parent_of_node;
+    std::vector<uint32_t> leaf_of_slot;
+
+    void build(const std::vector<shared_ptr<hittable>>& objects, const std::vector<double>& powers) {
+        std::vector<aabb> bounds;
+        bounds.reserve(objects.size());
+        for (const auto& light : objects) {
+            bounds.push_back(light->bounding_box());
+            bbox = aabb(bbox, light->bounding_box());
+        }
+
+        tree.build(bounds, 1);
+
+        lights.reserve(objects.size());
+        power.reserve(objects.size());
+        for (auto index : tree.prim_order) {
+            lights.push_back(objects[index]);
+            power.push_back(std::fmax(0.0, powers[index]));
+        }
+
+        build_alias_table();
+        build_power_tree();
+    }
+
+    void build_alias_table() {
+        auto count = power.size();
+        alias_keep.assign(count, 1.0);
+        alias_slot.resize(count);
+
+        total_power = 0;
+        for (auto p : power)
+            total_power += p;
+
+        if (total_power <= 0) {
+            // No light has any power; fall back to picking lights uniformly.
+            std::fill(power.begin(), power.end(), 1.0);
+            total_power = double(count);
+        }
+
+        std::vector<double> scaled(count);
+        std::vector<uint32_t> small, large;
+        for (uint32_t i = 0; i < count; i++) {
+            alias_slot[i] = i;
+            scaled[i] = power[i] * count / total_power;
+            (scaled[i] < 1 ? small : large).push_back(i);
+        }
+
+        while (!small.empty() && !large.empty()) {
+            auto s = small.back(); small.pop_back();
+            auto l = large.back();
+            alias_keep[s] = scaled[s];
+            alias_slot[s] = l;
+            scaled[l] -= 1 - scaled[s];
+            if (scaled[l] < 1) {
+                large.pop_back();
+                small.push_back(l);
+            }
+        }
+        // Whatever is left over is 1 up to rounding error, and keeps its own slot.
+    }
+
+    void build_power_tree() {
+        const auto& nodes = tree.nodes;
+        node_power.assign(nodes.size(), 0.0);
+        parent_of_node.assign(nodes.size(), 0);
+        leaf_of_slot.assign(lights.size(), 0);
+
+        // Children are stored after their parent, so a reverse sweep sees them first.
+        for (size_t n = nodes.size(); n-- > 0; ) {
+            const auto& node = nodes[n];
+            if (node.is_leaf()) {
+                for (uint32_t slot = node.offset; slot < node.offset + node.prim_count; slot++) {
+                    node_power[n] += power[slot];
+                    leaf_of_slot[slot] = uint32_t(n);
+                }
+            } else {
+                node_power[n] = node_power[n + 1] + node_power[node.offset];
+                parent_of_node[n + 1] = uint32_t(n);
+                parent_of_node[node.offset] = uint32_t(n);
+            }
+        }
+    }
+
+    uint32_t select(const point3& origin) const {
+        // Picks a light slot from a single sample dimension.
+        auto u = sample_1d();
+
+        if (selection == light_selection::power) {
+            auto count = lights.size();
+            auto scaled = u * count;
+            auto slot = std::min(uint32_t(scaled), uint32_t(count - 1));
+            return (scaled - slot < alias_keep[slot]) ? slot : alias_slot[slot];
+        }
+
+        // Descend the light BVH, rescaling u at each step so one sample drives the whole walk.
+        uint32_t node = 0;
+        while (!tree.nodes[node].is_leaf()) {
+            auto p_first = first_child_probability(node, origin);
+            if (u < p_first) {
+                u = u / p_first;
+                node = node + 1;
+            } else {
+                u = (u - p_first) / (1 - p_first);
+                node = tree.nodes[node].offset;
+            }
+            u = std::fmin(u, 0.99999999999999989);
+        }
+        return tree.nodes[node].offset;
+    }
+
+    double first_child_probability(uint32_t node, const point3& origin) const {
+        // Chance of descending into the first child of an interior node, in proportion to
+        // each child's power over its squared distance from the shading point. The distance
+        // is clamped to the child's half diagonal, so points near or inside a box don't
+        // blow up its importance.
+        auto first = importance(node + 1, origin);
+        auto second = importance(tree.nodes[node].offset, origin);
+        if (first + second <= 0)
+            return 0.5;
+        return first / (first + second);
+    }
+
+    double importance(uint32_t node, const point3& origin) const {
+        const auto& n = tree.nodes[node];
+        vec3 diagonal(n.bounds_max[0] - n.bounds_min[0],
+                      n.bounds_max[1] - n.bounds_min[1],
+                      n.bounds_max[2] - n.bounds_min[2]);
+        point3 center(0.5 * (n.bounds_min[0] + n.bounds_max[0]),
+                      0.5 * (n.bounds_min[1] + n.bounds_max[1]),
+                      0.5 * (n.bounds_min[2] + n.bounds_max[2]));
+
+        auto distance_squared = std::fmax((center - origin).length_squared(),
+                                          0.25 * diagonal.length_squared());
+        return node_power[node] / std::fmax(distance_squared, 1e-12);
+    }
+};
+
+inline shared_ptr<light_sampler> gather_lights(
+    const hittable& world, light_selection selection = light_selection::power
+) {
+    // Collects every emitting primitive in the world, with its power, into a light sampler.
+    // The lights share the world's geometry and materials, so they can't drift out of sync.
+    std::vector<emitter> emitters;
+    world.gather_emitters(nullptr, emitters);
+    return make_shared<light_sampler>(emitters, selection);
+}
+
+#endif
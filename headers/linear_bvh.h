@@ -0,0 +1,317 @@
+#ifndef LINEAR_BVH_H
+#define LINEAR_BVH_H
+
+#include "aabb.h"
+#include "bvh.h"
+#include "hittable.h"
+#include "hittable_list.h"
+#include "traversal_stats.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <numeric>
+#include <vector>
+
+class linear_bvh_node {
+  // One node of a flattened BVH, 32 bytes. Nodes are stored depth first, so the first child
+  // of an interior node always directly follows it in the array.
+  public:
+    float    bounds_min[3];
+    float    bounds_max[3];
+    uint32_t offset;      // Leaf: first primitive slot. Interior: index of the second child.
+    uint16_t prim_count;  // Number of primitives in a leaf, 0 for interior nodes
+    uint8_t  axis;        // Split axis of an interior node
+    uint8_t  pad;
+
+    bool is_leaf() const { return prim_count > 0; }
+};
+
+static_assert(sizeof(linear_bvh_node) == 32, "linear_bvh_node must stay 32 bytes");
+
+class flat_bvh {
+  // Builds and traverses a flattened BVH over primitives given only by their bounding boxes.
+  // Primitives are referred to by slot: the builder reorders them so each leaf covers a
+  // contiguous range of slots, and prim_order maps every slot back to its original index.
+  public:
+    std::vector<linear_bvh_node> nodes;
+    std::vector<uint32_t> prim_order;
+
+    void build(const std::vector<aabb>& prim_bounds, int max_leaf_size = 4) {
+        nodes.clear();
+        prim_order.resize(prim_bounds.size());
+        std::iota(prim_order.begin(), prim_order.end(), 0);
+
+        if (prim_bounds.empty())
+            return;
+
+        // Leaves never hold more than max_leaf_size primitives, so capping it keeps every leaf
+        // count within the node's 16-bit prim_count.
+        max_leaf_size = std::clamp(max_leaf_size, 1, int(std::numeric_limits<uint16_t>::max()));
+
+        nodes.reserve(2 * prim_bounds.size());
+        build_recursive(prim_bounds, 0, prim_order.size(), max_leaf_size, 0);
+    }
+
+    aabb bounding_box() const {
+        if (nodes.empty())
+            return aabb::empty;
+        const auto& root = nodes[0];
+        return aabb(interval(root.bounds_min[0], root.bounds_max[0]),
+                    interval(root.bounds_min[1], root.bounds_max[1]),
+                    interval(root.bounds_min[2], root.bounds_max[2]));
+    }
+
+    template <bool any_hit = false, typename LeafHit>
+    bool traverse(const ray& r, interval ray_t, LeafHit&& hit_slot) const {
+        // Visits every leaf whose box the ray enters within ray_t, calling
+        // hit_slot(slot, ray_t) for each primitive in it. The callback returns true on a hit
+        // after shrinking ray_t.max to the hit distance, so later boxes are culled against
+        // the closest hit so far. Interior nodes push the far child and descend into the
+        // child on the near side of the split plane, judged by the sign of the ray direction.
+        // With any_hit set, traversal stops at the first hit, for occlusion queries.
+
+        if (nodes.empty())
+            return false;
+
+        uint32_t stack[max_depth];
+        int stack_size = 0;
+        uint32_t current = 0;
+        bool hit_anything = false;
+
+        while (true) {
+            const auto& node = nodes[current];
+            record_node_visit(&node);
+
+            if (box_hit(node, r, ray_t)) {
+                if (node.is_leaf()) {
+                    for (uint32_t slot = node.offset; slot < node.offset + node.prim_count; slot++) {
+                        if (hit_slot(slot, ray_t)) {
+                            if (any_hit)
+                                return true;
+                            hit_anything = true;
+                        }
+                    }
+                } else if (r.dir_is_neg(node.axis)) {
+                    stack[stack_size++] = current + 1;
+                    current = node.offset;
+                    continue;
+                } else {
+                    stack[stack_size++] = node.offset;
+                    current = current + 1;
+                    continue;
+                }
+            }
+
+            if (stack_size == 0)
+                break;
+            current = stack[--stack_size];
+        }
+
+        return hit_anything;
+    }
+
+    template <typename LeafHit>
+    uint32_t traverse_packet(const ray_packet& packet, uint32_t mask, LeafHit&& hit_slot) const {
+        // traverse() for a packet: the lanes of mask walk the tree together, each node being
+        // tested against all of them and visited while any lane still enters it. Calls
+        // hit_slot(slot, lanes) for each primitive in a visited leaf, with the lanes that
+        // reached the leaf; it returns the lanes hit, having lowered their t_max. Children are
+        // ordered by the direction of the first lane, as the rays are assumed to be coherent.
+
+        if (nodes.empty() || !mask)
+            return 0;
+
+        int first_lane = 0;
+        while (!(mask & ray_packet::lane_bit(first_lane)))
+            first_lane++;
+        const bool dir_is_neg[3] = {
+            packet.inv_dir[0][first_lane] < 0, packet.inv_dir[1][first_lane] < 0, packet.inv_dir[2][first_lane] < 0
+        };
+
+        uint32_t stack[max_depth];
+        uint32_t stack_mask[max_depth];
+        int stack_size = 0;
+        uint32_t current = 0;
+        uint32_t hits = 0;
+
+        while (true) {
+            const auto& node = nodes[current];
+
+            // Lanes keep their mask bit on the stack, but their t_max may have dropped since.
+            auto node_mask = packet.hit_box(node.bounds_min, node.bounds_max, mask);
+            if (node_mask) {
+                if (node.is_leaf()) {
+                    for (uint32_t slot = node.offset; slot < node.offset + node.prim_count; slot++)
+                        hits |= hit_slot(slot, node_mask);
+                } else {
+                    auto near = dir_is_neg[node.axis] ? node.offset : current + 1;
+                    auto far  = dir_is_neg[node.axis] ? current + 1 : node.offset;
+                    stack[stack_size] = far;
+                    stack_mask[stack_size++] = node_mask;
+                    current = near;
+                    mask = node_mask;
+                    continue;
+                }
+            }
+
+            if (stack_size == 0)
+                break;
+            current = stack[--stack_size];
+            mask = stack_mask[stack_size];
+        }
+
+        return hits;
+    }
+
+  private:
+    // Traversal stack size. Subtrees deeper than half of this use median splits, which
+    // bounds the depth of the tree at max_depth for any primitive count that fits in 32 bits.
+    static constexpr int max_depth = 64;
+
+    static bool box_hit(const linear_bvh_node& node, const ray& r, interval ray_t) {
+        // Branchless slab test: the ray's direction signs pick which bound it enters through
+        // on each axis, so no comparison of the two distances is needed.
+        const point3& orig = r.origin();
+        const auto& inv_dir = r.inv_direction();
+
+        for (int axis = 0; axis < 3; axis++) {
+            bool neg = r.dir_is_neg(axis);
+            auto t0 = ((neg ? node.bounds_max : node.bounds_min)[axis] - orig[axis]) * inv_dir[axis];
+            auto t1 = ((neg ? node.bounds_min : node.bounds_max)[axis] - orig[axis]) * inv_dir[axis];
+
+            ray_t.min = t0 > ray_t.min ? t0 : ray_t.min;
+            ray_t.max = t1 < ray_t.max ? t1 : ray_t.max;
+        }
+        return ray_t.min < ray_t.max;
+    }
+
+    static float round_down(double x) {
+        // Nearest float not above x, so float bounds never shrink the double-precision box.
+        auto f = float(x);
+        return (double(f) > x) ? std::nextafter(f, -std::numeric_limits<float>::infinity()) : f;
+    }
+
+    static float round_up(double x) {
+        auto f = float(x);
+        return (double(f) < x) ? std::nextafter(f, std::numeric_limits<float>::infinity()) : f;
+    }
+
+    uint32_t build_recursive(
+        const std::vector<aabb>& prim_bounds, size_t start, size_t end, int max_leaf_size, int depth
+    ) {
+        auto node_index = uint32_t(nodes.size());
+        nodes.emplace_back();
+
+        aabb bbox = aabb::empty;
+        for (size_t i = start; i < end; i++)
+            bbox = aabb(bbox, prim_bounds[prim_order[i]]);
+
+        for (int axis = 0; axis < 3; axis++) {
+            nodes[node_index].bounds_min[axis] = round_down(bbox.axis_interval(axis).min);
+            nodes[node_index].bounds_max[axis] = round_up(bbox.axis_interval(axis).max);
+        }
+
+        size_t count = end - start;
+        auto first = prim_order.begin() + start;
+        auto last  = prim_order.begin() + end;
+        auto box_of = [&](uint32_t prim) -> const aabb& { return prim_bounds[prim]; };
+
+        // Choose a split. Small spans become leaves when the SAH says splitting doesn't pay.
+        auto middle = first;
+        int split_axis = 0;
+        if (count > 1) {
+            double split_cost = infinity;
+            if (depth < max_depth/2)
+                middle = bvh_sah::partition(first, last, split_cost, split_axis, box_of);
+
+            bool make_leaf = count <= size_t(max_leaf_size)
+                          && (middle == first || split_cost >= count * bvh_sah::intersection_cost);
+
+            if (make_leaf) {
+                middle = first;
+            } else if (middle == first) {
+                middle = first + count/2;
+                split_axis = bbox.longest_axis();
+                std::nth_element(first, middle, last, [&](uint32_t a, uint32_t b) {
+                    return prim_bounds[a].centroid()[split_axis]
+                         < prim_bounds[b].centroid()[split_axis];
+                });
+            }
+        }
+
+        if (middle == first) {
+            nodes[node_index].offset = uint32_t(start);
+            nodes[node_index].prim_count = uint16_t(count);
+            nodes[node_index].axis = 0;
+            return node_index;
+        }
+
+        auto mid = size_t(middle - prim_order.begin());
+        build_recursive(prim_bounds, start, mid, max_leaf_size, depth + 1);
+        auto second = build_recursive(prim_bounds, mid, end, max_leaf_size, depth + 1);
+
+        nodes[node_index].offset = second;
+        nodes[node_index].prim_count = 0;
+        nodes[node_index].axis = uint8_t(split_axis);
+        return node_index;
+    }
+};
+
+class linear_bvh : public hittable {
+  public:
+    linear_bvh(const hittable_list& list, int max_leaf_size = 4) {
+        // Builds a compact BVH over the objects of the list. The list itself is not modified.
+        std::vector<aabb> bounds;
+        bounds.reserve(list.objects.size());
+        for (const auto& object : list.objects)
+            bounds.push_back(object->bounding_box());
+
+        tree.build(bounds, max_leaf_size);
+
+        objects.reserve(list.objects.size());
+        for (auto index : tree.prim_order)
+            objects.push_back(list.objects[index]);
+
+        bbox = list.bounding_box();
+    }
+
+    bool intersect(const ray& r, interval ray_t, hit_record& rec) const override {
+        return tree.traverse(r, ray_t, [&](uint32_t slot, interval& t) {
+            if (!objects[slot]->intersect(r, t, rec))
+                return false;
+            t.max = rec.t;
+            return true;
+        });
+    }
+
+    bool occluded(const ray& r, interval ray_t) const override {
+        return tree.traverse<true>(r, ray_t, [&](uint32_t slot, interval& t) {
+            return objects[slot]->occluded(r, t);
+        });
+    }
+
+    uint32_t intersect_packet(ray_packet& packet, uint32_t mask, hit_record recs[]) const override {
+        return tree.traverse_packet(packet, mask, [&](uint32_t slot, uint32_t lanes) {
+            return objects[slot]->intersect_packet(packet, lanes, recs);
+        });
+    }
+
+    aabb bounding_box() const override { return bbox; }
+
+    void gather_emitters(const shared_ptr<hittable>&, std::vector<emitter>& lights)
+    const override {
+        for (const auto& object : objects)
+            object->gather_emitters(object, lights);
+    }
+
+    size_t node_count() const { return tree.nodes.size(); }
+
+  private:
+    flat_bvh tree;
+    std::vector<shared_ptr<hittable>> objects;  // In leaf slot order
+    aabb bbox;
+};
+
+#endif
@@ -5,12 +5,21 @@
 #include "texture.h"
 #include "pdf.h"
 
+#include <variant>
+
 class scatter_record {
   public:
     color attenuation;
-    shared_ptr<pdf> pdf_ptr;
+    std::variant<std::monostate, cosine_pdf, sphere_pdf> scatter_pdf;  // Held by value
     bool skip_pdf;
     ray skip_pdf_ray;
+
+    const pdf& pdf_ref() const {
+        // The sampling distribution of a scatter that doesn't skip the pdf.
+        if (auto cosine = std::get_if<cosine_pdf>(&scatter_pdf))
+            return *cosine;
+        return std::get<sphere_pdf>(scatter_pdf);
+    }
 };
 
 class material {
@@ -31,8 +40,19 @@ class material {
     const {
         return 0;
     }
+
+    // Typical radiance emitted from the front face, used to estimate a light's power.
+    virtual color emission() const {
+        return color(0,0,0);
+    }
 };
 
+inline double emitter_power(uint32_t mat_id, double area) {
+    // Power leaving a one-sided diffuse emitter of the given area and material.
+    auto mat = material_table::get(mat_id);
+    return mat ? pi * area * luminance(mat->emission()) : 0;
+}
+
 class lambertian : public material {
   public:
     lambertian(const color& albedo) : tex(make_shared<solid_color>(albedo)) {}
@@ -40,7 +60,7 @@ class lambertian : public material {
 
     bool scatter(const ray& r_in, const hit_record& rec, scatter_record& srec) const override {
         srec.attenuation = tex->value(rec.u, rec.v, rec.p);
-        srec.pdf_ptr = make_shared<cosine_pdf>(rec.normal);
+        srec.scatter_pdf.emplace<cosine_pdf>(rec.normal);
         srec.skip_pdf = false;
         return true;
     }
@@ -64,7 +84,7 @@ class metal : public material {
         reflected = unit_vector(reflected) + (fuzz * random_unit_vector());
         
         srec.attenuation = albedo;
-        srec.pdf_ptr = nullptr;
+        srec.scatter_pdf = std::monostate();
         srec.skip_pdf = true;
         srec.skip_pdf_ray = ray(rec.p, reflected, r_in.time());
 
@@ -82,7 +102,7 @@ class dielectric : public material {
 
     bool scatter(const ray& r_in, const hit_record& rec, scatter_record& srec) const override {
         srec.attenuation = color(1.0, 1.0, 1.0);
-        srec.pdf_ptr = nullptr;
+        srec.scatter_pdf = std::monostate();
         srec.skip_pdf = true;
         double ri = rec.front_face ? (1.0/refraction_index) : refraction_index;
 
@@ -127,6 +147,11 @@ class diffuse_light : public material {
         return tex->value(u, v, p);
     }
 
+    color emission() const override {
+        // Exact for solid colors; textured lights are estimated from one lookup.
+        return tex->value(0.5, 0.5, point3(0,0,0));
+    }
+
   private:
     shared_ptr<texture> tex;
 };
@@ -138,7 +163,7 @@ class isotropic : public material {
 
     bool scatter(const ray& r_in, const hit_record& rec, scatter_record& srec) const override {
         srec.attenuation = tex->value(rec.u, rec.v, rec.p);
-        srec.pdf_ptr = make_shared<sphere_pdf>();
+        srec.scatter_pdf.emplace<sphere_pdf>();
         srec.skip_pdf = false;
         return true;
     }
@@ -0,0 +1,176 @@
+#ifndef OBJ_LOADER_H
+#define OBJ_LOADER_H
+
+#include "triangle_mesh.h"
+
+#include <climits>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+class obj_loader {
+  // Streams a Wavefront OBJ file line by line into a single triangle_mesh. Reads positions
+  // (v), texture coordinates (vt), normals (vn) and faces (f) with any of the v, v/vt, v//vn
+  // and v/vt/vn corner forms, including negative (relative) indices. Polygons are split into
+  // triangle fans. Every other statement (groups, materials, smoothing) is ignored.
+  public:
+    static shared_ptr<triangle_mesh> load(const std::string& filename, shared_ptr<material> mat) {
+        // Returns the mesh in the file. If the file cannot be read, reports an error and
+        // returns an empty mesh.
+
+        std::ifstream file(filename);
+        if (!file) {
+            std::cerr << "ERROR: Could not load OBJ file '" << filename << "'.\n";
+            return make_shared<triangle_mesh>(
+                std::vector<point3>(), std::vector<uint32_t>(), mat);
+        }
+
+        obj_loader loader;
+        std::string line;
+        while (std::getline(file, line))
+            loader.parse_line(line.c_str());
+
+        if (!loader.any_normals) loader.normals.clear();
+        if (!loader.any_uvs)     loader.uvs.clear();
+
+        return make_shared<triangle_mesh>(
+            std::move(loader.positions), std::move(loader.indices), mat,
+            std::move(loader.normals), std::move(loader.uvs));
+    }
+
+  private:
+    // Attributes as read from the file, indexed by the file's own numbering.
+    std::vector<point3> file_positions;
+    std::vector<vec3>   file_uvs;
+    std::vector<vec3>   file_normals;
+
+    // Mesh vertices, one per distinct (position, uv, normal) corner.
+    std::vector<point3>   positions;
+    std::vector<vec3>     uvs;
+    std::vector<vec3>     normals;
+    std::vector<uint32_t> indices;
+    bool any_uvs = false;
+    bool any_normals = false;
+
+    class corner {
+      public:
+        long position, uv, normal;  // Resolved 0-based file indices, -1 if absent
+
+        bool operator==(const corner& other) const {
+            return position == other.position && uv == other.uv && normal == other.normal;
+        }
+    };
+
+    class corner_hash {
+      public:
+        size_t operator()(const corner& c) const {
+            return size_t(mix_bits(uint64_t(c.position) ^ mix_bits(uint64_t(c.uv) ^ mix_bits(uint64_t(c.normal)))));
+        }
+    };
+
+    std::unordered_map<corner, uint32_t, corner_hash> vertex_of_corner;
+    std::vector<uint32_t> face;
+
+    static constexpr uint32_t invalid_vertex = UINT32_MAX;
+
+    static const char* skip_space(const char* s) {
+        while (*s == ' ' || *s == '\t') s++;
+        return s;
+    }
+
+    static vec3 parse_vec3(const char* s) {
+        char* end;
+        double x = std::strtod(s, &end);
+        double y = std::strtod(end, &end);
+        double z = std::strtod(end, &end);
+        return vec3(x, y, z);
+    }
+
+    static long resolve(long index, size_t count) {
+        // OBJ indices are 1-based; negative indices count back from the latest element.
+        return index < 0 ? long(count) + index : index - 1;
+    }
+
+    void parse_line(const char* s) {
+        s = skip_space(s);
+
+        if (s[0] == 'v' && (s[1] == ' ' || s[1] == '\t')) {
+            file_positions.push_back(parse_vec3(s + 2));
+        } else if (s[0] == 'v' && s[1] == 't') {
+            file_uvs.push_back(parse_vec3(s + 2));
+        } else if (s[0] == 'v' && s[1] == 'n') {
+            file_normals.push_back(parse_vec3(s + 2));
+        } else if (s[0] == 'f' && (s[1] == ' ' || s[1] == '\t')) {
+            parse_face(s + 2);
+        }
+    }
+
+    void parse_face(const char* s) {
+        face.clear();
+
+        while (true) {
+            s = skip_space(s);
+            if (*s == '\0' || *s == '\r' || *s == '#')
+                break;
+
+            char* end;
+            long p = std::strtol(s, &end, 10), t = 0, n = 0;
+            if (end == s)
+                break;
+            s = end;
+
+            if (*s == '/') {
+                s++;
+                if (*s != '/') { t = std::strtol(s, &end, 10); s = end; }
+                if (*s == '/') { s++; n = std::strtol(s, &end, 10); s = end; }
+            }
+
+            auto vertex = corner_vertex(p, t, n);
+            if (vertex == invalid_vertex)
+                return;  // Skip faces that refer to positions that don't exist.
+            face.push_back(vertex);
+        }
+
+        for (size_t k = 2; k < face.size(); k++) {
+            indices.push_back(face[0]);
+            indices.push_back(face[k-1]);
+            indices.push_back(face[k]);
+        }
+    }
+
+    uint32_t corner_vertex(long p, long t, long n) {
+        // Returns the mesh vertex for a face corner, creating it the first time it's seen.
+        // Returns invalid_vertex if the position index is out of range; out-of-range texture
+        // coordinate and normal indices are treated as absent.
+        auto position_index = resolve(p, file_positions.size());
+        if (position_index < 0 || position_index >= long(file_positions.size()))
+            return invalid_vertex;
+
+        auto uv_index = t ? resolve(t, file_uvs.size()) : -1;
+        auto normal_index = n ? resolve(n, file_normals.size()) : -1;
+        if (uv_index >= long(file_uvs.size())) uv_index = -1;
+        if (normal_index >= long(file_normals.size())) normal_index = -1;
+        if (uv_index < -1) uv_index = -1;
+        if (normal_index < -1) normal_index = -1;
+
+        corner key{position_index, uv_index, normal_index};
+        auto found = vertex_of_corner.find(key);
+        if (found != vertex_of_corner.end())
+            return found->second;
+
+        auto vertex = uint32_t(positions.size());
+        positions.push_back(file_positions[position_index]);
+        uvs.push_back(uv_index >= 0 ? file_uvs[uv_index] : vec3(0,0,0));
+        normals.push_back(normal_index >= 0 ? file_normals[normal_index] : vec3(0,0,0));
+        any_uvs |= uv_index >= 0;
+        any_normals |= normal_index >= 0;
+
+        vertex_of_corner.emplace(key, vertex);
+        return vertex;
+    }
+};
+
+#endif
@@ -21,7 +21,12 @@ class sphere_pdf : public pdf {
     }
 
     vec3 generate() const override {
-        return random_unit_vector();
+        // Uniform direction on the unit sphere from the next two sample dimensions.
+        auto u = sample_2d();
+        auto z = 1 - 2*u.x();
+        auto r = std::sqrt(std::fmax(0, 1 - z*z));
+        auto phi = 2*pi*u.y();
+        return vec3(r*std::cos(phi), r*std::sin(phi), z);
     }
 };
 
@@ -35,7 +40,8 @@ class cosine_pdf : public pdf {
     }
 
     vec3 generate() const override {
-        return uvw.transform(random_cosine_direction());
+        auto u = sample_2d();
+        return uvw.transform(random_cosine_direction(u.x(), u.y()));
     }
 
   private:
@@ -62,10 +68,12 @@ class hittable_pdf : public pdf {
 };
 
 class mixture_pdf : public pdf {
+  // An even mix of two pdfs. The pdfs are referenced, not owned, so they must outlive the
+  // mixture; callers keep them on the stack for the duration of one bounce.
   public:
-    mixture_pdf(shared_ptr<pdf> p0, shared_ptr<pdf> p1) {
-        p[0] = p0;
-        p[1] = p1;
+    mixture_pdf(const pdf& p0, const pdf& p1) {
+        p[0] = &p0;
+        p[1] = &p1;
     }
 
     double value(const vec3& direction) const override {
@@ -73,14 +81,14 @@ class mixture_pdf : public pdf {
     }
 
     vec3 generate() const override {
-        if (random_double() < 0.5)
+        if (sample_1d() < 0.5)
             return p[0]->generate();
         else
             return p[1]->generate();
     }
 
   private:
-    shared_ptr<pdf> p[2];
+    const pdf* p[2];
 };
 
 #endif
\ No newline at end of file
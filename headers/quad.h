@@ -3,11 +3,12 @@
 
 #include "hittable.h"
 #include "hittable_list.h"
+#include "material.h"
 
 class quad : public hittable {
   public:
     quad(const point3& Q, const vec3& u, const vec3& v, shared_ptr<material> mat)
-      : Q(Q), u(u), v(v), mat(mat)
+      : Q(Q), u(u), v(v), mat_id(material_table::add(mat))
     {
         auto n = cross(u, v);
         normal = unit_vector(n);
@@ -28,7 +29,7 @@ class quad : public hittable {
 
     aabb bounding_box() const override { return bbox; }
 
-    bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+    bool intersect(const ray& r, interval ray_t, hit_record& rec) const override {
         auto denom = dot(normal, r.direction());
 
         // No hit if the ray is parallel to the plane.
@@ -49,15 +50,70 @@ class quad : public hittable {
         if (!is_interior(alpha, beta, rec))
             return false;
 
-        // Ray hits the 2D shape; set the rest of the hit record and return true.
+        // Ray hits the 2D shape; the rest of the hit record waits for finalize().
         rec.t = t;
-        rec.p = intersection;
-        rec.mat = mat;
-        rec.set_face_normal(r, normal);
+        rec.object = this;
 
         return true;
     }
 
+    uint32_t intersect_packet(ray_packet& packet, uint32_t mask, hit_record recs[]) const override {
+        // intersect() on all lanes at once, up to the (virtual) interior test, which runs per
+        // lane for the lanes that hit the plane.
+        using pd = packet_double;
+
+        pd o[3], d[3];
+        for (int axis = 0; axis < 3; axis++) {
+            o[axis] = pd::load(packet.org[axis]);
+            d[axis] = pd::load(packet.dir[axis]);
+        }
+        auto n = [&](int axis) { return pd::broadcast(normal[axis]); };
+
+        auto denom = n(0)*d[0] + n(1)*d[1] + n(2)*d[2];
+        auto t = (pd::broadcast(D) - (n(0)*o[0] + n(1)*o[1] + n(2)*o[2])) / denom;
+
+        mask &= ((pd::broadcast(1e-8) <= lane_abs(denom))
+                 & (pd::load(packet.t_min) <= t) & (t <= pd::load(packet.t_max))).bits();
+        if (!mask)
+            return 0;
+
+        // The hit point relative to Q, in plane coordinates:
+        // alpha = dot(w, cross(p, v)), beta = dot(w, cross(u, p)).
+        pd p[3];
+        for (int axis = 0; axis < 3; axis++)
+            p[axis] = (o[axis] + t * d[axis]) - pd::broadcast(Q[axis]);
+
+        auto b = [](double x) { return pd::broadcast(x); };
+        auto alpha = b(w[0]) * (p[1]*b(v[2]) - p[2]*b(v[1]))
+                   + b(w[1]) * (p[2]*b(v[0]) - p[0]*b(v[2]))
+                   + b(w[2]) * (p[0]*b(v[1]) - p[1]*b(v[0]));
+        auto beta  = b(w[0]) * (b(u[1])*p[2] - b(u[2])*p[1])
+                   + b(w[1]) * (b(u[2])*p[0] - b(u[0])*p[2])
+                   + b(w[2]) * (b(u[0])*p[1] - b(u[1])*p[0]);
+
+        double t_lane[ray_packet::size], alpha_lane[ray_packet::size], beta_lane[ray_packet::size];
+        t.store(t_lane);
+        alpha.store(alpha_lane);
+        beta.store(beta_lane);
+
+        uint32_t hits = 0;
+        for (int k = 0; k < ray_packet::size; k++) {
+            if ((mask & ray_packet::lane_bit(k)) && is_interior(alpha_lane[k], beta_lane[k], recs[k])) {
+                recs[k].t = t_lane[k];
+                recs[k].object = this;
+                packet.t_max[k] = t_lane[k];
+                hits |= ray_packet::lane_bit(k);
+            }
+        }
+        return hits;
+    }
+
+    void finalize(const ray& r, hit_record& rec) const override {
+        rec.p = r.at(rec.t);
+        rec.mat_id = mat_id;
+        rec.set_face_normal(r, normal);
+    }
+
     virtual bool is_interior(double a, double b, hit_record& rec) const {
         interval unit_interval = interval(0, 1);
         // Given the hit point in plane coordinates, return false if it is outside the
@@ -73,17 +129,20 @@ class quad : public hittable {
 
     double pdf_value(const point3& origin, const vec3& direction) const override {
         hit_record rec;
-        if (!this->hit(ray(origin, direction), interval(0.001, infinity), rec))
+        if (!this->intersect(ray(origin, direction), interval(0.001, infinity), rec))
             return 0;
 
         auto distance_squared = rec.t * rec.t * direction.length_squared();
-        auto cosine = std::fabs(dot(direction, rec.normal) / direction.length());
+        auto cosine = std::fabs(dot(direction, normal) / direction.length());
 
         return distance_squared / (cosine * area);
     }
 
+    double emitted_power() const override { return emitter_power(mat_id, area); }
+
     vec3 random(const point3& origin) const override {
-        auto p = Q + (random_double() * u) + (random_double() * v);
+        auto s = sample_2d();
+        auto p = Q + (s.x() * u) + (s.y() * v);
         return p - origin;
     }
 
@@ -91,7 +150,7 @@ class quad : public hittable {
     point3 Q;
     vec3 u, v;
     vec3 w;
-    shared_ptr<material> mat;
+    uint32_t mat_id;
     aabb bbox;
     vec3 normal;
     double D;
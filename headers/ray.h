@@ -8,7 +8,16 @@ class ray {
     ray() {}
 
     ray(const point3& origin, const vec3& direction, double time)
-      : orig(origin), dir(direction), tm(time) {}
+      : orig(origin), dir(direction), tm(time)
+    {
+        // A ray is tested against many boxes, so the reciprocal of its direction and the
+        // signs of its components are worked out once, here. The reciprocals are kept in
+        // double precision, as box bounds are.
+        for (int axis = 0; axis < 3; axis++) {
+            inv_dir[axis] = 1.0 / dir[axis];
+            neg[axis] = inv_dir[axis] < 0;
+        }
+    }
 
     ray(const point3& origin, const vec3& direction)
       : ray(origin, direction, 0) {}
@@ -18,6 +27,12 @@ class ray {
 
     double time() const { return tm; }
 
+    // 1 / direction, componentwise; infinite along axes the ray is parallel to.
+    const vec3_t<double>& inv_direction() const { return inv_dir; }
+
+    // Whether the ray runs toward -infinity along the axis, including a direction of -0.
+    bool dir_is_neg(int axis) const { return neg[axis]; }
+
     point3 at(double t) const {
         return orig + t*dir;
     }
@@ -26,6 +41,8 @@ class ray {
     point3 orig;
     vec3 dir;
     double tm;
+    vec3_t<double> inv_dir;
+    bool neg[3];
 };
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,260 @@
+#ifndef RAY_PACKET_H
+#define RAY_PACKET_H
+
+#include "aabb.h"
+#include "ray.h"
+
+#include <cstdint>
+#include <cstring>
+
+// Packet lanes use AVX or SSE2 registers when the target has them, unless RT_NO_SIMD is
+// defined. RT_PACKET_SIMD(op) names the intrinsic _mm256_op_pd or _mm_op_pd. Tracing camera
+// rays in packets only beats single rays with AVX, so RT_PACKET_AVX marks the builds where
+// the camera offers it.
+#if !defined(RT_NO_SIMD) && defined(__AVX__)
+#include <immintrin.h>
+#define RT_PACKET_SIMD(op) _mm256_##op##_pd
+#define RT_PACKET_AVX
+using packet_register = __m256d;
+inline __m256d packet_register_lt(__m256d x, __m256d y) { return _mm256_cmp_pd(x, y, _CMP_LT_OQ); }
+inline __m256d packet_register_le(__m256d x, __m256d y) { return _mm256_cmp_pd(x, y, _CMP_LE_OQ); }
+#elif !defined(RT_NO_SIMD) && (defined(__SSE2__) || defined(_M_X64))
+#include <emmintrin.h>
+#define RT_PACKET_SIMD(op) _mm_##op##_pd
+using packet_register = __m128d;
+inline __m128d packet_register_lt(__m128d x, __m128d y) { return _mm_cmplt_pd(x, y); }
+inline __m128d packet_register_le(__m128d x, __m128d y) { return _mm_cmple_pd(x, y); }
+#endif
+
+#ifdef RT_PACKET_SIMD
+
+constexpr int packet_register_lanes = int(sizeof(packet_register) / sizeof(double));
+constexpr int packet_registers = 8 / packet_register_lanes;
+
+class packet_double {
+  // One double per packet lane, eight in all, with arithmetic applied lane by lane: two AVX
+  // or four SSE2 registers, or a loop over the lanes without SIMD. Every operation rounds
+  // exactly as the scalar operation does, so packet and single-ray code agree.
+  public:
+    packet_register part[packet_registers];
+
+    static packet_double load(const double* p) {
+        packet_double a;
+        for (int i = 0; i < packet_registers; i++)
+            a.part[i] = RT_PACKET_SIMD(loadu)(p + i * packet_register_lanes);
+        return a;
+    }
+
+    static packet_double broadcast(double x) {
+        packet_double a;
+        for (auto& part : a.part)
+            part = RT_PACKET_SIMD(set1)(x);
+        return a;
+    }
+
+    void store(double* p) const {
+        for (int i = 0; i < packet_registers; i++)
+            RT_PACKET_SIMD(storeu)(p + i * packet_register_lanes, part[i]);
+    }
+};
+
+class packet_mask {
+  // Per-lane result of a packet comparison.
+  public:
+    packet_register part[packet_registers];
+
+    uint32_t bits() const {
+        uint32_t mask = 0;
+        for (int i = 0; i < packet_registers; i++)
+            mask |= uint32_t(RT_PACKET_SIMD(movemask)(part[i])) << (i * packet_register_lanes);
+        return mask;
+    }
+};
+
+#define RT_PACKET_OP(result, name, type, expr)                                  \
+    inline result name(const type& a, const type& b) {                         \
+        result r;                                                               \
+        for (int i = 0; i < packet_registers; i++) {                            \
+            auto x = a.part[i], y = b.part[i];                                  \
+            r.part[i] = expr;                                                   \
+        }                                                                       \
+        return r;                                                               \
+    }
+
+RT_PACKET_OP(packet_double, operator+, packet_double, RT_PACKET_SIMD(add)(x, y))
+RT_PACKET_OP(packet_double, operator-, packet_double, RT_PACKET_SIMD(sub)(x, y))
+RT_PACKET_OP(packet_double, operator*, packet_double, RT_PACKET_SIMD(mul)(x, y))
+RT_PACKET_OP(packet_double, operator/, packet_double, RT_PACKET_SIMD(div)(x, y))
+RT_PACKET_OP(packet_double, lane_min,  packet_double, RT_PACKET_SIMD(min)(x, y))  // x < y ? x : y
+RT_PACKET_OP(packet_double, lane_max,  packet_double, RT_PACKET_SIMD(max)(x, y))  // x > y ? x : y
+RT_PACKET_OP(packet_mask,   operator<,  packet_double, packet_register_lt(x, y))
+RT_PACKET_OP(packet_mask,   operator<=, packet_double, packet_register_le(x, y))
+RT_PACKET_OP(packet_mask,   operator&,  packet_mask,   RT_PACKET_SIMD(and)(x, y))
+RT_PACKET_OP(packet_mask,   operator|,  packet_mask,   RT_PACKET_SIMD(or)(x, y))
+
+#undef RT_PACKET_OP
+
+inline packet_double lane_sqrt(const packet_double& a) {
+    packet_double r;
+    for (int i = 0; i < packet_registers; i++)
+        r.part[i] = RT_PACKET_SIMD(sqrt)(a.part[i]);
+    return r;
+}
+
+inline packet_double lane_abs(const packet_double& a) {
+    packet_double r;
+    for (int i = 0; i < packet_registers; i++)
+        r.part[i] = RT_PACKET_SIMD(andnot)(RT_PACKET_SIMD(set1)(-0.0), a.part[i]);
+    return r;
+}
+
+inline packet_double select(const packet_mask& m, const packet_double& a, const packet_double& b) {
+    // a in the lanes where m is set, b elsewhere.
+    packet_double r;
+    for (int i = 0; i < packet_registers; i++)
+        r.part[i] = RT_PACKET_SIMD(or)(RT_PACKET_SIMD(and)(m.part[i], a.part[i]),
+                                       RT_PACKET_SIMD(andnot)(m.part[i], b.part[i]));
+    return r;
+}
+
+#else
+
+class packet_double {
+  public:
+    double lane[8];
+
+    static packet_double load(const double* p) {
+        packet_double a;
+        std::memcpy(a.lane, p, sizeof a.lane);
+        return a;
+    }
+
+    static packet_double broadcast(double x) {
+        packet_double a;
+        for (auto& v : a.lane) v = x;
+        return a;
+    }
+
+    void store(double* p) const { std::memcpy(p, lane, sizeof lane); }
+};
+
+class packet_mask {
+  public:
+    bool lane[8];
+
+    uint32_t bits() const {
+        uint32_t mask = 0;
+        for (int k = 0; k < 8; k++)
+            mask |= uint32_t(lane[k]) << k;
+        return mask;
+    }
+};
+
+#define RT_PACKET_OP(result, name, type, expr)                                  \
+    inline result name(const type& a, const type& b) {                         \
+        result r;                                                               \
+        for (int k = 0; k < 8; k++) {                                           \
+            auto x = a.lane[k], y = b.lane[k];                                  \
+            r.lane[k] = expr;                                                   \
+        }                                                                       \
+        return r;                                                               \
+    }
+
+RT_PACKET_OP(packet_double, operator+, packet_double, x + y)
+RT_PACKET_OP(packet_double, operator-, packet_double, x - y)
+RT_PACKET_OP(packet_double, operator*, packet_double, x * y)
+RT_PACKET_OP(packet_double, operator/, packet_double, x / y)
+RT_PACKET_OP(packet_double, lane_min,  packet_double, x < y ? x : y)
+RT_PACKET_OP(packet_double, lane_max,  packet_double, x > y ? x : y)
+RT_PACKET_OP(packet_mask,   operator<,  packet_double, x < y)
+RT_PACKET_OP(packet_mask,   operator<=, packet_double, x <= y)
+RT_PACKET_OP(packet_mask,   operator&,  packet_mask,   x && y)
+RT_PACKET_OP(packet_mask,   operator|,  packet_mask,   x || y)
+
+#undef RT_PACKET_OP
+
+inline packet_double lane_sqrt(const packet_double& a) {
+    packet_double r;
+    for (int k = 0; k < 8; k++) r.lane[k] = std::sqrt(a.lane[k]);
+    return r;
+}
+
+inline packet_double lane_abs(const packet_double& a) {
+    packet_double r;
+    for (int k = 0; k < 8; k++) r.lane[k] = std::fabs(a.lane[k]);
+    return r;
+}
+
+inline packet_double select(const packet_mask& m, const packet_double& a, const packet_double& b) {
+    packet_double r;
+    for (int k = 0; k < 8; k++) r.lane[k] = m.lane[k] ? a.lane[k] : b.lane[k];
+    return r;
+}
+
+#endif
+
+class ray_packet {
+  // Eight rays traced together, such as the camera rays of one pixel, stored lane by lane
+  // (structure of arrays) so each component loads straight into a packet_double. Each lane
+  // keeps its own ray interval, which shrinks to the closest hit found so far. Routines
+  // that take a packet also take a mask, one bit per lane, of the lanes to trace; the other
+  // lanes must still hold some valid ray, as the arithmetic runs on all of them.
+  public:
+    static constexpr int size = 8;
+
+    double org[3][size];
+    double dir[3][size];
+    double inv_dir[3][size];
+    double time[size];
+    double t_min[size];
+    double t_max[size];
+
+    // If the lanes are separate samples, each one's random state. Primitives traced one lane
+    // at a time swap it in, so random numbers drawn during intersection (as constant_medium
+    // does) come from the lane's own sample.
+    random_state* lane_random = nullptr;
+
+    static constexpr uint32_t lane_bit(int lane) { return 1u << lane; }
+
+    void set(int lane, const ray& r, interval ray_t) {
+        for (int axis = 0; axis < 3; axis++) {
+            org[axis][lane] = r.origin()[axis];
+            dir[axis][lane] = r.direction()[axis];
+            inv_dir[axis][lane] = r.inv_direction()[axis];
+        }
+        time[lane] = r.time();
+        t_min[lane] = ray_t.min;
+        t_max[lane] = ray_t.max;
+    }
+
+    ray lane_ray(int lane) const {
+        return ray(point3(org[0][lane], org[1][lane], org[2][lane]),
+                   vec3(dir[0][lane], dir[1][lane], dir[2][lane]), time[lane]);
+    }
+
+    template <typename T>
+    uint32_t hit_box(const T box_min[3], const T box_max[3], uint32_t mask) const {
+        // Slab test of every lane against the box, with the same result as aabb::hit: the
+        // min and max pick the same operand as its comparisons do, NaN included. Returns the
+        // lanes of mask whose ray enters the box within its interval.
+        auto lo = packet_double::load(t_min);
+        auto hi = packet_double::load(t_max);
+        for (int axis = 0; axis < 3; axis++) {
+            auto o = packet_double::load(org[axis]);
+            auto inv = packet_double::load(inv_dir[axis]);
+            auto t0 = (packet_double::broadcast(box_min[axis]) - o) * inv;
+            auto t1 = (packet_double::broadcast(box_max[axis]) - o) * inv;
+            lo = lane_max(lane_min(t0, t1), lo);
+            hi = lane_min(lane_max(t1, t0), hi);
+        }
+        return mask & (lo < hi).bits();
+    }
+
+    uint32_t hit_box(const aabb& box, uint32_t mask) const {
+        double box_min[3] = { box.x.min, box.y.min, box.z.min };
+        double box_max[3] = { box.x.max, box.y.max, box.z.max };
+        return hit_box(box_min, box_max, mask);
+    }
+};
+
+#endif
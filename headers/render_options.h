@@ -0,0 +1,157 @@
+#ifndef RENDER_OPTIONS_H
+#define RENDER_OPTIONS_H
+
+#include "camera.h"
+
+#include <cstdlib>
+#include <ostream>
+#include <string>
+
+class render_options {
+  // Command line settings shared by the example programs: where the image goes and how it is
+  // rendered, as opposed to what the scene holds. main() parses them and hands them to the
+  // scene, which applies them to its camera.
+  public:
+    std::string output_file;            // PNG to write (empty = PPM to stdout)
+    std::string denoise_mode;           // Denoising filter (empty = none)
+    std::string integrator;             // Path integrator (empty = camera default)
+
+    double adaptive_threshold = 0;      // Relative error that stops a pixel (0 = not adaptive)
+    double sample_budget = 0;           // Adaptive: average samples per pixel for the image
+    std::string heatmap_file;           // Adaptive: PNG of the samples each pixel took
+
+    double time_budget = 0;             // Progressive: seconds before the render stops
+    double snapshot_interval = 0;       // Progressive: seconds between output snapshots
+
+    std::string checkpoint_file;        // Render state saved here and resumed from it
+    double checkpoint_interval = 60;    // Seconds between checkpoints
+
+    bool packets = false;               // Trace camera rays in packets
+    bool ray_benchmark = false;         // Time camera rays alone instead of rendering
+    bool wavefront = false;             // Trace paths as a wavefront
+    bool sort_rays = false;             // Wavefront: bin bounce rays before tracing them
+    bool ray_stats = false;             // Wavefront: log BVH nodes visited per batch of bounce rays
+
+    bool parse(int argc, char* argv[], int& i) {
+        // Takes the argument argv[i], and its value if it has one, leaving i on the last
+        // argument used. Returns false if argv[i] isn't one of these settings.
+        std::string arg = argv[i];
+        bool has_value = i + 1 < argc;
+
+        if (arg == "--denoise" && has_value)
+            denoise_mode = argv[++i];
+        else if (arg == "--integrator" && has_value)
+            integrator = argv[++i];
+        else if (arg == "--adaptive" && has_value)
+            adaptive_threshold = std::atof(argv[++i]);
+        else if (arg == "--sample-budget" && has_value)
+            sample_budget = std::atof(argv[++i]);
+        else if (arg == "--heatmap" && has_value)
+            heatmap_file = argv[++i];
+        else if (arg == "--time-budget" && has_value)
+            time_budget = std::atof(argv[++i]);
+        else if (arg == "--snapshot" && has_value)
+            snapshot_interval = std::atof(argv[++i]);
+        else if (arg == "--checkpoint" && has_value)
+            checkpoint_file = argv[++i];
+        else if (arg == "--checkpoint-interval" && has_value)
+            checkpoint_interval = std::atof(argv[++i]);
+        else if (arg == "--packets")
+            packets = true;
+        else if (arg == "--ray-benchmark")
+            ray_benchmark = true;
+        else if (arg == "--wavefront")
+            wavefront = true;
+        else if (arg == "--sort-rays")
+            sort_rays = true;
+        else if (arg == "--ray-stats")
+            ray_stats = true;
+        else
+            return false;
+        return true;
+    }
+
+    void apply(camera& cam) const {
+        if (!denoise_mode.empty()) {
+            cam.denoise = true;
+            cam.denoise_mode = denoise_mode;
+        }
+
+        if (!integrator.empty())
+            cam.integrator = integrator;
+
+        if (adaptive_threshold > 0) {
+            cam.adaptive = true;
+            cam.adaptive_threshold = adaptive_threshold;
+            cam.adaptive_budget = sample_budget;
+            cam.heatmap_file = heatmap_file;
+        }
+
+        if (time_budget > 0 || snapshot_interval > 0) {
+            cam.progressive = true;
+            cam.time_budget = time_budget;
+            cam.snapshot_interval = snapshot_interval;
+            cam.snapshot_file = output_file;
+        }
+
+        if (!checkpoint_file.empty()) {
+            cam.checkpoint_file = checkpoint_file;
+            cam.checkpoint_interval = checkpoint_interval;
+        }
+
+        cam.packet_tracing = packets;
+        cam.wavefront = wavefront;
+        cam.sort_rays = sort_rays;
+        cam.ray_stats = ray_stats;
+    }
+
+    void print_summary(std::ostream& out) const {
+        // Logs the settings that differ from a plain render, one line each.
+        if (!output_file.empty())
+            out << "Output: " << output_file << "\n";
+        if (!denoise_mode.empty())
+            out << "Denoising: " << denoise_mode << "\n";
+        if (!integrator.empty())
+            out << "Integrator: " << integrator << "\n";
+        if (adaptive_threshold > 0) {
+            out << "Adaptive sampling: threshold " << adaptive_threshold;
+            if (sample_budget > 0)
+                out << ", budget " << sample_budget << " samples per pixel";
+            out << "\n";
+        }
+        if (time_budget > 0 || snapshot_interval > 0) {
+            out << "Progressive: time budget " << time_budget << " s, snapshot every "
+                << snapshot_interval << " s\n";
+        }
+        if (!checkpoint_file.empty())
+            out << "Checkpoint: " << checkpoint_file << " every " << checkpoint_interval << " s\n";
+    }
+
+    static void print_usage(std::ostream& out) {
+        out << "Denoising: --denoise bilateral|median|fast (optional, post-processes final image)\n"
+            << "Integrator: --integrator mixture|nee (optional, default=mixture)\n"
+            << "  nee: next-event estimation, a shadow ray per diffuse bounce with MIS weights\n"
+            << "Adaptive sampling: --adaptive THRESHOLD (optional, e.g. 0.02)\n"
+            << "  stops each pixel once its relative standard error falls below THRESHOLD;\n"
+            << "  the quality preset's sample count becomes the per-pixel cap\n"
+            << "  --sample-budget SPP caps the average samples per pixel over the whole image;\n"
+            << "  once it runs short, the least noisy pixels stop first\n"
+            << "  --heatmap FILE writes a PNG of samples per pixel (blue=few, red=cap)\n"
+            << "Progressive rendering: renders in passes of doubling samples per pixel\n"
+            << "  --time-budget SECONDS stops after the pass running at the deadline\n"
+            << "  --snapshot SECONDS rewrites the output PNG with the image so far\n"
+            << "Checkpoints: --checkpoint FILE saves the render state every 60 seconds\n"
+            << "  (or --checkpoint-interval SECONDS) and resumes from FILE if it exists;\n"
+            << "  the file is removed once the render finishes\n"
+            << "Packet tracing: --packets traces each pixel's camera rays in packets of 8\n"
+            << "  (AVX builds only, e.g. compiled with -march=native; others trace single rays)\n"
+            << "  --ray-benchmark times camera rays alone, single and in packets, and exits\n"
+            << "Wavefront: --wavefront traces each tile's paths in batches, one stage at a time\n"
+            << "  (same image as without it; takes precedence over --packets)\n"
+            << "  --sort-rays bins bounce rays by direction octant and origin before tracing\n"
+            << "  --ray-stats logs the BVH nodes each batch of bounce rays visits\n"
+            << "  (builds with -DRT_TRAVERSAL_STATS only)\n";
+    }
+};
+
+#endif
@@ -0,0 +1,63 @@
+#ifndef RNG_H
+#define RNG_H
+
+#include <cstdint>
+
+class pcg32 {
+  // PCG-XSH-RR generator with 64 bits of state and a selectable stream (M.E. O'Neill, 2014).
+  // Small enough to live in a thread_local and be copied around with a path.
+  public:
+    pcg32() { seed(0x853c49e6748fea9bULL, 0xda3e39cb94b95bdbULL); }
+
+    pcg32(uint64_t initstate, uint64_t initseq) { seed(initstate, initseq); }
+
+    void seed(uint64_t initstate, uint64_t initseq) {
+        state = 0;
+        inc = (initseq << 1) | 1;
+        next_uint();
+        state += initstate;
+        next_uint();
+    }
+
+    uint32_t next_uint() {
+        uint64_t oldstate = state;
+        state = oldstate * 6364136223846793005ULL + inc;
+        auto xorshifted = uint32_t(((oldstate >> 18) ^ oldstate) >> 27);
+        auto rot = uint32_t(oldstate >> 59);
+        return (xorshifted >> rot) | (xorshifted << ((-rot) & 31));
+    }
+
+    double next_double() {
+        // Returns a random real in [0,1).
+        return next_uint() * (1.0 / 4294967296.0);
+    }
+
+    uint64_t state;
+    uint64_t inc;
+};
+
+inline uint64_t mix_bits(uint64_t v) {
+    // SplitMix64 finalizer: scatters every input bit across the whole 64-bit result.
+    v ^= v >> 30;
+    v *= 0xbf58476d1ce4e5b9ULL;
+    v ^= v >> 27;
+    v *= 0x94d049bb133111ebULL;
+    v ^= v >> 31;
+    return v;
+}
+
+inline pcg32& thread_rng() {
+    // Each thread owns its generator, so drawing numbers never touches shared state.
+    static thread_local pcg32 rng;
+    return rng;
+}
+
+inline void seed_thread_rng(uint64_t pixel, uint64_t sample, uint64_t frame) {
+    // Restarts this thread's generator on a stream determined only by the pixel index, the
+    // sample index within that pixel and the frame number, so a sample draws the same
+    // numbers no matter which thread renders it or in what order.
+    auto key = mix_bits(mix_bits(mix_bits(frame) ^ pixel) ^ sample);
+    thread_rng().seed(key, mix_bits(key ^ 0x9e3779b97f4a7c15ULL));
+}
+
+#endif
@@ -7,6 +7,7 @@
 #include <limits>
 #include <memory>
 
+#include "rng.h"
 
 // C++ Std Usings
 
@@ -25,8 +26,8 @@ inline double degrees_to_radians(double degrees) {
 }
 
 inline double random_double() {
-    // Returns a random real in [0,1).
-    return std::rand() / (RAND_MAX + 1.0);
+    // Returns a random real in [0,1) from the calling thread's generator.
+    return thread_rng().next_double();
 }
 
 inline double random_double(double min, double max) {
@@ -45,5 +46,6 @@ inline int random_int(int min, int max) {
 #include "interval.h"
 #include "ray.h"
 #include "vec3.h"
+#include "sampler.h"
 
 #endif
\ No newline at end of file
@@ -0,0 +1,170 @@
+#ifndef SAMPLER_H
+#define SAMPLER_H
+
+#include <cstdint>
+#include <string>
+
+// A sampler hands each camera path a sample vector, one dimension at a time: the pixel
+// position, lens position, time, and then the choices made at every bounce. Backends map
+// (pixel seed, sample index, dimension) to a value in [0,1), so they hold no per-path state
+// and one instance can serve every render thread.
+
+class sampler {
+  public:
+    virtual ~sampler() = default;
+
+    virtual double sample(uint64_t seed, uint32_t index, uint32_t dimension) const = 0;
+
+    // True if the camera should keep its own jittered sub-pixel grid, rather than take the
+    // pixel position from the first two dimensions of the sample vector.
+    virtual bool stratifies_pixel() const { return false; }
+};
+
+class independent_sampler : public sampler {
+  public:
+    double sample(uint64_t, uint32_t, uint32_t) const override {
+        // Plain uniform random numbers from the thread's generator (already seeded per sample).
+        return random_double();
+    }
+
+    bool stratifies_pixel() const override { return true; }
+};
+
+class sobol_sampler : public sampler {
+  // Padded 2D Sobol: every pair of dimensions (2k, 2k+1) is drawn from the first two Sobol
+  // dimensions, with the sample index shuffled per pair so the pairs are decorrelated from
+  // each other. Owen scrambling replaces the random-digit (XOR) scrambling with nested
+  // uniform scrambling, which keeps the net structure while removing the sequence's
+  // structured artifacts and improving convergence for smooth integrands.
+  public:
+    sobol_sampler(bool owen_scramble) : owen_scramble(owen_scramble) {}
+
+    double sample(uint64_t seed, uint32_t index, uint32_t dimension) const override {
+        auto pair_seed = uint32_t(mix_bits(seed ^ (uint64_t(dimension / 2) << 32)));
+        auto dim_seed  = uint32_t(mix_bits(seed + dimension + 1));
+
+        auto shuffled_index = nested_uniform_scramble(index, pair_seed);
+        auto x = (dimension % 2 == 0) ? reverse_bits(shuffled_index) : sobol_dimension_1(shuffled_index);
+
+        x = owen_scramble ? nested_uniform_scramble(x, dim_seed) : (x ^ dim_seed);
+
+        // Keep the top 24 bits so the result stays strictly below 1 in float precision too.
+        return (x >> 8) * (1.0 / 16777216.0);
+    }
+
+  private:
+    bool owen_scramble;
+
+    static uint32_t reverse_bits(uint32_t x) {
+        x = (x << 16) | (x >> 16);
+        x = ((x & 0x00ff00ff) << 8) | ((x & 0xff00ff00) >> 8);
+        x = ((x & 0x0f0f0f0f) << 4) | ((x & 0xf0f0f0f0) >> 4);
+        x = ((x & 0x33333333) << 2) | ((x & 0xcccccccc) >> 2);
+        x = ((x & 0x55555555) << 1) | ((x & 0xaaaaaaaa) >> 1);
+        return x;
+    }
+
+    static uint32_t sobol_dimension_1(uint32_t index) {
+        // Second Sobol dimension (the first is the bit-reversed index, i.e. van der Corput).
+        uint32_t result = 0;
+        for (uint32_t v = 1u << 31; index != 0; index >>= 1, v ^= v >> 1) {
+            if (index & 1)
+                result ^= v;
+        }
+        return result;
+    }
+
+    static uint32_t laine_karras_permutation(uint32_t x, uint32_t seed) {
+        // Hash-based permutation where each bit only depends on itself and lower bits.
+        x += seed;
+        x ^= x * 0x6c50b47cu;
+        x ^= x * 0xb82f1e52u;
+        x ^= x * 0xc7afe638u;
+        x ^= x * 0x8d22f6e6u;
+        return x;
+    }
+
+    static uint32_t nested_uniform_scramble(uint32_t x, uint32_t seed) {
+        // Owen scrambling: each bit is flipped depending on all of the more significant bits.
+        return reverse_bits(laine_karras_permutation(reverse_bits(x), seed));
+    }
+};
+
+inline shared_ptr<sampler> make_sampler(const std::string& type) {
+    // Returns the sampler backend for "independent", "sobol" or "owen". Unknown names fall
+    // back to independent uniform sampling.
+    if (type == "sobol") return make_shared<sobol_sampler>(false);
+    if (type == "owen")  return make_shared<sobol_sampler>(true);
+    return make_shared<independent_sampler>();
+}
+
+// Per-thread sample stream
+
+class sample_stream {
+  public:
+    const sampler* backend = nullptr;  // No backend: fall back to random_double()
+    uint64_t seed = 0;                 // Identifies the pixel and frame
+    uint32_t index = 0;                // Sample index within the pixel
+    uint32_t dimension = 0;            // Next dimension to hand out
+};
+
+inline sample_stream& thread_sample_stream() {
+    static thread_local sample_stream stream;
+    return stream;
+}
+
+class random_state {
+  // A snapshot of the calling thread's generator and sample stream, so a sample can be set
+  // aside and picked up again after other samples have run on the thread.
+  public:
+    pcg32 rng;
+    sample_stream stream;
+
+    void save() {
+        rng = thread_rng();
+        stream = thread_sample_stream();
+    }
+
+    void restore() const {
+        thread_rng() = rng;
+        thread_sample_stream() = stream;
+    }
+};
+
+inline void start_pixel_sample(const sampler* backend, uint64_t pixel, uint32_t index, int frame) {
+    // Points this thread's stream at the first dimension of the given pixel sample.
+    auto& stream = thread_sample_stream();
+    stream.backend = backend;
+    stream.seed = mix_bits(pixel ^ mix_bits(uint64_t(frame) + 1));
+    stream.index = index;
+    stream.dimension = 0;
+}
+
+inline void end_pixel_samples() {
+    // Detaches this thread from the sampler so later draws go back to random_double().
+    thread_sample_stream().backend = nullptr;
+}
+
+inline double sample_1d() {
+    // Returns the next dimension of the current sample vector.
+    auto& stream = thread_sample_stream();
+    if (!stream.backend)
+        return random_double();
+    return stream.backend->sample(stream.seed, stream.index, stream.dimension++);
+}
+
+inline vec3 sample_2d() {
+    // Returns the next two dimensions of the current sample vector as (u, v, 0). Pairs always
+    // start on an even dimension so they line up with the backend's 2D-stratified pairs.
+    auto& stream = thread_sample_stream();
+    if (!stream.backend)
+        return vec3(random_double(), random_double(), 0);
+
+    stream.dimension += stream.dimension % 2;
+    auto u = stream.backend->sample(stream.seed, stream.index, stream.dimension);
+    auto v = stream.backend->sample(stream.seed, stream.index, stream.dimension + 1);
+    stream.dimension += 2;
+    return vec3(u, v, 0);
+}
+
+#endif
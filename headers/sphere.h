@@ -2,13 +2,15 @@
 #define SPHERE_H
 
 #include "hittable.h"
+#include "material.h"
 #include "onb.h"
 
 class sphere : public hittable {
   public:
     // Stationary Sphere
     sphere(const point3& static_center, double radius, shared_ptr<material> mat)
-      : center(static_center, vec3(0,0,0)), radius(std::fmax(0,radius)), mat(mat)
+      : center(static_center, vec3(0,0,0)), radius(std::fmax(0,radius)),
+        mat_id(material_table::add(mat))
     {
         auto rvec = vec3(radius, radius, radius);
         bbox = aabb(static_center - rvec, static_center + rvec);
@@ -17,7 +19,8 @@ class sphere : public hittable {
     // Moving Sphere
     sphere(const point3& center1, const point3& center2, double radius,
            shared_ptr<material> mat)
-      : center(center1, center2 - center1), radius(std::fmax(0,radius)), mat(mat)
+      : center(center1, center2 - center1), radius(std::fmax(0,radius)),
+        mat_id(material_table::add(mat))
     {
         auto rvec = vec3(radius, radius, radius);
         aabb box1(center.at(0) - rvec, center.at(0) + rvec);
@@ -25,7 +28,7 @@ class sphere : public hittable {
         bbox = aabb(box1, box2);
     }
 
-    bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+    bool intersect(const ray& r, interval ray_t, hit_record& rec) const override {
         point3 current_center = center.at(r.time());
         vec3 oc = current_center - r.origin();
         auto a = r.direction().length_squared();
@@ -47,13 +50,62 @@ class sphere : public hittable {
         }
 
         rec.t = root;
+        rec.object = this;
+
+        return true;
+    }
+
+    uint32_t intersect_packet(ray_packet& packet, uint32_t mask, hit_record recs[]) const override {
+        // intersect() on all lanes at once, step for step.
+        using pd = packet_double;
+
+        auto time = pd::load(packet.time);
+        pd oc[3];
+        for (int axis = 0; axis < 3; axis++) {
+            auto current_center = pd::broadcast(center.origin()[axis])
+                                + time * pd::broadcast(center.direction()[axis]);
+            oc[axis] = current_center - pd::load(packet.org[axis]);
+        }
+
+        auto dx = pd::load(packet.dir[0]), dy = pd::load(packet.dir[1]), dz = pd::load(packet.dir[2]);
+        auto a = dx*dx + dy*dy + dz*dz;
+        auto h = dx*oc[0] + dy*oc[1] + dz*oc[2];
+        auto c = (oc[0]*oc[0] + oc[1]*oc[1] + oc[2]*oc[2]) - pd::broadcast(radius*radius);
+
+        auto discriminant = h*h - a*c;
+        mask &= (pd::broadcast(0) <= discriminant).bits();
+        if (!mask)
+            return 0;
+
+        auto sqrtd = lane_sqrt(discriminant);
+        auto t_min = pd::load(packet.t_min), t_max = pd::load(packet.t_max);
+
+        // Find the nearest root that lies in the acceptable range.
+        auto near_root = (h - sqrtd) / a;
+        auto far_root  = (h + sqrtd) / a;
+        auto near_ok = (t_min < near_root) & (near_root < t_max);
+        auto far_ok  = (t_min < far_root) & (far_root < t_max);
+
+        double root[ray_packet::size];
+        select(near_ok, near_root, far_root).store(root);
+
+        auto hits = mask & (near_ok | far_ok).bits();
+        for (int k = 0; k < ray_packet::size; k++) {
+            if (hits & ray_packet::lane_bit(k)) {
+                recs[k].t = root[k];
+                recs[k].object = this;
+                packet.t_max[k] = root[k];
+            }
+        }
+        return hits;
+    }
+
+    void finalize(const ray& r, hit_record& rec) const override {
         rec.p = r.at(rec.t);
-        vec3 outward_normal = (rec.p - current_center) / radius;
+        vec3 outward_normal = (rec.p - center.at(r.time())) / radius;
         rec.set_face_normal(r, outward_normal);
         get_sphere_uv(outward_normal, rec.u, rec.v);
-        rec.mat = mat;
-
-        return true;
+        rec.mat_id = mat_id;
     }
 
     aabb bounding_box() const override { return bbox; }
@@ -62,7 +114,7 @@ class sphere : public hittable {
         // This method only works for stationary spheres.
 
         hit_record rec;
-        if (!this->hit(ray(origin, direction), interval(0.001, infinity), rec))
+        if (!this->intersect(ray(origin, direction), interval(0.001, infinity), rec))
             return 0;
 
         auto dist_squared = (center.at(0) - origin).length_squared();
@@ -72,6 +124,13 @@ class sphere : public hittable {
         return  1 / solid_angle;
     }
 
+    double emitted_power() const override {
+        // Light sampling only handles stationary spheres.
+        if (!center.direction().near_zero())
+            return 0;
+        return emitter_power(mat_id, 4*pi*radius*radius);
+    }
+
     vec3 random(const point3& origin) const override {
         vec3 direction = center.at(0) - origin;
         auto distance_squared = direction.length_squared();
@@ -82,7 +141,7 @@ class sphere : public hittable {
   private:
     ray center;
     double radius;
-    shared_ptr<material> mat;
+    uint32_t mat_id;
     aabb bbox;
 
     static void get_sphere_uv(const point3& p, double& u, double& v) {
@@ -101,8 +160,9 @@ class sphere : public hittable {
     }
 
     static vec3 random_to_sphere(double radius, double distance_squared) {
-        auto r1 = random_double();
-        auto r2 = random_double();
+        auto s = sample_2d();
+        auto r1 = s.x();
+        auto r2 = s.y();
         auto z = 1 + r2*(std::sqrt(1-radius*radius/distance_squared) - 1);
 
         auto phi = 2*pi*r1;
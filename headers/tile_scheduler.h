@@ -0,0 +1,116 @@
+#ifndef TILE_SCHEDULER_H
+#define TILE_SCHEDULER_H
+
+#include <algorithm>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class tile {
+  public:
+    int x0, y0;  // Upper left pixel (inclusive)
+    int x1, y1;  // Lower right pixel (exclusive)
+};
+
+class tile_scheduler {
+  public:
+    tile_scheduler(int image_width, int image_height, int tile_size) {
+        // Split the image into square tiles of tile_size pixels, in scanline order. Tiles on
+        // the right and bottom edges are clipped to the image.
+
+        tile_size = std::max(tile_size, 1);
+        for (int y = 0; y < image_height; y += tile_size) {
+            for (int x = 0; x < image_width; x += tile_size) {
+                tiles.push_back(tile{
+                    x, y, std::min(x + tile_size, image_width), std::min(y + tile_size, image_height)
+                });
+            }
+        }
+    }
+
+    size_t tile_count() const { return tiles.size(); }
+
+    static int default_thread_count() {
+        // Returns the number of hardware threads, or 1 if it cannot be determined.
+        auto n = int(std::thread::hardware_concurrency());
+        return n > 0 ? n : 1;
+    }
+
+    void run(int thread_count, const std::function<void(const tile&)>& render_tile) {
+        // Renders every tile exactly once across thread_count workers (the calling thread is
+        // one of them). Each worker starts with a contiguous run of tiles in its own queue and
+        // takes from the front of it; once empty, it steals from the back of another worker's
+        // queue. Tiles cover disjoint pixels, so the output does not depend on which worker
+        // ends up rendering which tile.
+        run_tasks(tiles.size(), thread_count, [&](size_t t) { render_tile(tiles[t]); });
+    }
+
+    static void run_tasks(size_t task_count, int thread_count, const std::function<void(size_t)>& task) {
+        // Runs task(0) through task(task_count - 1) once each, on the same work-stealing pool
+        // that renders tiles, for other work that splits into independent pieces.
+
+        if (task_count == 0)
+            return;
+        if (thread_count <= 0)
+            thread_count = default_thread_count();
+        thread_count = int(std::max<size_t>(1, std::min(size_t(thread_count), task_count)));
+
+        std::vector<work_queue> queues(thread_count);
+        for (size_t t = 0; t < task_count; t++)
+            queues[t * thread_count / task_count].tiles.push_back(t);
+
+        auto worker = [&](int id) {
+            size_t t;
+            while (queues[id].pop_front(t) || steal(queues, id, t))
+                task(t);
+        };
+
+        std::vector<std::thread> threads;
+        for (int id = 1; id < thread_count; id++)
+            threads.emplace_back(worker, id);
+
+        worker(0);
+
+        for (auto& thread : threads)
+            thread.join();
+    }
+
+  private:
+    class work_queue {
+      public:
+        std::mutex lock;
+        std::deque<size_t> tiles;
+
+        bool pop_front(size_t& t) {
+            std::lock_guard<std::mutex> guard(lock);
+            if (tiles.empty()) return false;
+            t = tiles.front();
+            tiles.pop_front();
+            return true;
+        }
+
+        bool pop_back(size_t& t) {
+            std::lock_guard<std::mutex> guard(lock);
+            if (tiles.empty()) return false;
+            t = tiles.back();
+            tiles.pop_back();
+            return true;
+        }
+    };
+
+    std::vector<tile> tiles;
+
+    static bool steal(std::vector<work_queue>& queues, int thief, size_t& t) {
+        // Try every other worker's queue once, starting with the next one over.
+        int n = int(queues.size());
+        for (int i = 1; i < n; i++) {
+            if (queues[(thief + i) % n].pop_back(t))
+                return true;
+        }
+        return false;
+    }
+};
+
+#endif
@@ -0,0 +1,72 @@
+#ifndef TRAVERSAL_STATS_H
+#define TRAVERSAL_STATS_H
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+// BVH traversals record the nodes they visit only in builds with RT_TRAVERSAL_STATS defined.
+// Elsewhere record_node_visit is empty, and ordinary traversals pay nothing for it.
+#ifdef RT_TRAVERSAL_STATS
+constexpr bool traversal_stats_enabled = true;
+#else
+constexpr bool traversal_stats_enabled = false;
+#endif
+
+class node_visit_log {
+  // The BVH nodes whose boxes the calling thread tests while the log is attached to it, for
+  // measuring how much of the tree a batch of rays shares. With no log attached (the
+  // default), a stats build pays one thread-local load per node.
+  public:
+    std::vector<const void*> nodes;
+
+    static node_visit_log*& attached() {
+        static thread_local node_visit_log* log = nullptr;
+        return log;
+    }
+
+    size_t unique_count() {
+        // Number of distinct nodes in the log. Reorders the log.
+        std::sort(nodes.begin(), nodes.end());
+        return size_t(std::unique(nodes.begin(), nodes.end()) - nodes.begin());
+    }
+};
+
+#ifdef RT_TRAVERSAL_STATS
+inline void record_node_visit(const void* node) {
+    if (auto log = node_visit_log::attached())
+        log->nodes.push_back(node);
+}
+#else
+inline void record_node_visit(const void*) {}
+#endif
+
+class coherence_stats {
+  // Totals over batches of rays traced with a node_visit_log attached. Fewer unique nodes per
+  // batch, for the same visits per ray, means the rays in a batch walk the same parts of the
+  // tree and find them in cache.
+  public:
+    uint64_t batches = 0;
+    uint64_t rays = 0;
+    uint64_t node_visits = 0;   // Box tests, counting each time a node is tested
+    uint64_t unique_nodes = 0;  // Distinct nodes tested by each batch, summed over batches
+
+    void add_batch(size_t ray_count, node_visit_log& log) {
+        // Folds in a batch of ray_count rays and clears the log for the next batch.
+        batches++;
+        rays += ray_count;
+        node_visits += log.nodes.size();
+        unique_nodes += log.unique_count();
+        log.nodes.clear();
+    }
+
+    coherence_stats& operator+=(const coherence_stats& other) {
+        batches += other.batches;
+        rays += other.rays;
+        node_visits += other.node_visits;
+        unique_nodes += other.unique_nodes;
+        return *this;
+    }
+};
+
+#endif
@@ -0,0 +1,183 @@
+#ifndef TRIANGLE_MESH_H
+#define TRIANGLE_MESH_H
+
+#include "hittable.h"
+#include "linear_bvh.h"
+
+#include <cstdint>
+#include <vector>
+
+class triangle_mesh : public hittable {
+  // An indexed triangle mesh with its own BVH, so the whole mesh is a single object in the
+  // scene. Vertex data lives in flat arrays; normals and texture coordinates are optional and
+  // either empty or one per position. Texture coordinates use the x and y components.
+  public:
+    triangle_mesh(
+        std::vector<point3> positions, std::vector<uint32_t> indices, shared_ptr<material> mat,
+        std::vector<vec3> normals = {}, std::vector<vec3> uvs = {}
+    ) : positions(std::move(positions)), normals(std::move(normals)), uvs(std::move(uvs)),
+        mat_id(material_table::add(mat))
+    {
+        auto count = indices.size() / 3;
+
+        std::vector<aabb> bounds(count);
+        for (size_t tri = 0; tri < count; tri++) {
+            const auto& p0 = this->positions[indices[3*tri]];
+            const auto& p1 = this->positions[indices[3*tri + 1]];
+            const auto& p2 = this->positions[indices[3*tri + 2]];
+            bounds[tri] = aabb(aabb(p0, p1), aabb(p2, p2));
+            bbox = aabb(bbox, bounds[tri]);
+        }
+
+        blas.build(bounds);
+
+        // Store the triangles in leaf slot order, so each leaf reads a contiguous index range.
+        this->indices.resize(3 * count);
+        for (size_t slot = 0; slot < count; slot++) {
+            auto tri = blas.prim_order[slot];
+            for (int k = 0; k < 3; k++)
+                this->indices[3*slot + k] = indices[3*tri + k];
+        }
+    }
+
+    size_t triangle_count() const { return indices.size() / 3; }
+
+    bool intersect(const ray& r, interval ray_t, hit_record& rec) const override {
+        // Records the closest triangle's slot and barycentrics; finalize() shades it.
+        watertight_ray wr(r);
+
+        return blas.traverse(r, ray_t, [&](uint32_t slot, interval& t) {
+            double t_hit, b1, b2;
+            if (!intersect_triangle(wr, slot, t, t_hit, b1, b2))
+                return false;
+            t.max = t_hit;
+            rec.t = t_hit;
+            rec.object = this;
+            rec.prim_id = slot;
+            rec.b1 = b1;
+            rec.b2 = b2;
+            return true;
+        });
+    }
+
+    bool occluded(const ray& r, interval ray_t) const override {
+        watertight_ray wr(r);
+
+        return blas.traverse<true>(r, ray_t, [&](uint32_t slot, interval& t) {
+            double t_hit, b1, b2;
+            return intersect_triangle(wr, slot, t, t_hit, b1, b2);
+        });
+    }
+
+    void finalize(const ray& r, hit_record& rec) const override {
+        auto slot = rec.prim_id;
+        auto hit_b1 = rec.b1, hit_b2 = rec.b2;
+        auto i0 = indices[3*slot], i1 = indices[3*slot + 1], i2 = indices[3*slot + 2];
+        auto b0 = 1 - hit_b1 - hit_b2;
+        const auto& p0 = positions[i0];
+        const auto& p1 = positions[i1];
+        const auto& p2 = positions[i2];
+
+        rec.p = b0*p0 + hit_b1*p1 + hit_b2*p2;
+        rec.set_face_normal(r, unit_vector(cross(p1 - p0, p2 - p0)));
+
+        if (!normals.empty()) {
+            // Shade with the interpolated vertex normal, on the same side as the geometry.
+            // Vertices without a normal are stored as zero; fall back to the geometric normal
+            // if the interpolation degenerates.
+            auto shading = b0*normals[i0] + hit_b1*normals[i1] + hit_b2*normals[i2];
+            if (!shading.near_zero()) {
+                shading = unit_vector(shading);
+                rec.normal = dot(shading, rec.normal) < 0 ? -shading : shading;
+            }
+        }
+
+        if (!uvs.empty()) {
+            auto uv = b0*uvs[i0] + hit_b1*uvs[i1] + hit_b2*uvs[i2];
+            rec.u = uv.x();
+            rec.v = uv.y();
+        } else {
+            rec.u = hit_b1;
+            rec.v = hit_b2;
+        }
+
+        rec.mat_id = mat_id;
+    }
+
+    aabb bounding_box() const override { return bbox; }
+
+  private:
+    std::vector<point3>   positions;
+    std::vector<vec3>     normals;
+    std::vector<vec3>     uvs;
+    std::vector<uint32_t> indices;  // Three per triangle, in BLAS leaf slot order
+    uint32_t              mat_id;
+    flat_bvh blas;
+    aabb bbox;
+
+    class watertight_ray {
+      // Per-ray setup of the watertight ray/triangle test (Woop, Benthin and Wald, 2013): a
+      // permutation of the axes that makes z the dominant direction axis, and a shear that
+      // maps the ray onto the +z axis.
+      public:
+        watertight_ray(const ray& r) : orig(r.origin()) {
+            const vec3& d = r.direction();
+            kz = (std::fabs(d.x()) > std::fabs(d.y()))
+               ? (std::fabs(d.x()) > std::fabs(d.z()) ? 0 : 2)
+               : (std::fabs(d.y()) > std::fabs(d.z()) ? 1 : 2);
+            kx = (kz + 1) % 3;
+            ky = (kx + 1) % 3;
+            if (d[kz] < 0)
+                std::swap(kx, ky);
+
+            sx = d[kx] / d[kz];
+            sy = d[ky] / d[kz];
+            sz = 1.0 / d[kz];
+        }
+
+        point3 orig;
+        int kx, ky, kz;
+        double sx, sy, sz;
+    };
+
+    bool intersect_triangle(
+        const watertight_ray& wr, uint32_t slot, interval ray_t, double& t, double& b1, double& b2
+    ) const {
+        auto a = positions[indices[3*slot]]     - wr.orig;
+        auto b = positions[indices[3*slot + 1]] - wr.orig;
+        auto c = positions[indices[3*slot + 2]] - wr.orig;
+
+        // Shear and scale the vertices into ray space.
+        auto ax = a[wr.kx] - wr.sx*a[wr.kz], ay = a[wr.ky] - wr.sy*a[wr.kz];
+        auto bx = b[wr.kx] - wr.sx*b[wr.kz], by = b[wr.ky] - wr.sy*b[wr.kz];
+        auto cx = c[wr.kx] - wr.sx*c[wr.kz], cy = c[wr.ky] - wr.sy*c[wr.kz];
+
+        // Scaled barycentrics are edge functions of the origin; a shared edge evaluates to the
+        // same value (with opposite sign) for both of its triangles, so no ray slips through.
+        auto u = cx*by - cy*bx;
+        auto v = ax*cy - ay*cx;
+        auto w = bx*ay - by*ax;
+
+        if ((u < 0 || v < 0 || w < 0) && (u > 0 || v > 0 || w > 0))
+            return false;
+
+        auto det = u + v + w;
+        if (det == 0)
+            return false;
+
+        auto az = wr.sz * a[wr.kz];
+        auto bz = wr.sz * b[wr.kz];
+        auto cz = wr.sz * c[wr.kz];
+        auto t_scaled = u*az + v*bz + w*cz;
+
+        t = t_scaled / det;
+        if (!ray_t.surrounds(t))
+            return false;
+
+        b1 = v / det;
+        b2 = w / det;
+        return true;
+    }
+};
+
+#endif
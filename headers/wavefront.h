@@ -0,0 +1,180 @@
+#ifndef WAVEFRONT_H
+#define WAVEFRONT_H
+
+#include "hittable.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+// Storage for wavefront path tracing. Rather than following one path from the camera to its
+// end, a wavefront render keeps a pool of paths in flight and moves all of them through one
+// stage at a time: generate camera rays, extend (closest hit), shade, trace shadow rays, and
+// accumulate finished paths. Each stage loops over an index queue of pool slots, so it runs
+// one piece of code over thousands of paths before moving on.
+
+class path_pool {
+  // Paths in flight, as parallel arrays indexed by slot, so a stage streams through only the
+  // fields it uses. Slots are recycled as paths finish.
+  public:
+    std::vector<ray> rays;             // The ray each path traces next
+    std::vector<hit_record> recs;      // Closest hit of that ray, after the extend stage
+    std::vector<uint8_t> hits;         // Whether the ray hit anything
+    std::vector<color> throughput;     // Product of the scattering weights so far
+    std::vector<color> radiance;       // Light gathered so far
+    std::vector<double> bsdf_pdf;      // Density of the BSDF sample that produced the ray
+    std::vector<int> depth;            // Vertices shaded so far
+    std::vector<uint32_t> sample;      // Work item the path computes
+    std::vector<random_state> random;  // Random state between stages
+
+    void reset(size_t capacity) {
+        // Empties the pool and makes room for capacity paths.
+        rays.resize(capacity);
+        recs.resize(capacity);
+        hits.resize(capacity);
+        throughput.resize(capacity);
+        radiance.resize(capacity);
+        bsdf_pdf.resize(capacity);
+        depth.resize(capacity);
+        sample.resize(capacity);
+        random.resize(capacity);
+
+        // Hand out low slots first, so a pool that never fills stays compact.
+        free_slots.clear();
+        for (auto slot = capacity; slot-- > 0; )
+            free_slots.push_back(uint32_t(slot));
+    }
+
+    bool full() const { return free_slots.empty(); }
+
+    uint32_t allocate() {
+        auto slot = free_slots.back();
+        free_slots.pop_back();
+        return slot;
+    }
+
+    void release(uint32_t slot) { free_slots.push_back(slot); }
+
+  private:
+    std::vector<uint32_t> free_slots;
+};
+
+class shadow_queue {
+  // Shadow rays waiting for their visibility test, each with the light it brings to its path
+  // if nothing lies along it before max_t.
+  public:
+    std::vector<ray> rays;
+    std::vector<double> max_t;
+    std::vector<color> contribution;
+    std::vector<uint32_t> path;        // Pool slot of the path the light is added to
+    std::vector<random_state> random;  // Random state for tests that draw numbers (media)
+
+    size_t size() const { return rays.size(); }
+
+    void clear() {
+        rays.clear();
+        max_t.clear();
+        contribution.clear();
+        path.clear();
+        random.clear();
+    }
+
+    void push(const ray& shadow, double t, const color& light, uint32_t slot, const random_state& state) {
+        rays.push_back(shadow);
+        max_t.push_back(t);
+        contribution.push_back(light);
+        path.push_back(slot);
+        random.push_back(state);
+    }
+};
+
+inline void sort_by_material(
+    const std::vector<uint32_t>& slots, const std::vector<hit_record>& recs,
+    std::vector<uint32_t>& sorted
+) {
+    // Counting sort of the slots by the material of their hit, keeping the order of slots
+    // that share a material. Material ids are small and dense, so this is one linear pass.
+    uint32_t max_id = 0;
+    for (auto slot : slots)
+        max_id = std::max(max_id, recs[slot].mat_id);
+
+    std::vector<uint32_t> start(size_t(max_id) + 2, 0);
+    for (auto slot : slots)
+        start[recs[slot].mat_id + 1]++;
+    for (size_t id = 1; id < start.size(); id++)
+        start[id] += start[id - 1];
+
+    sorted.resize(slots.size());
+    for (auto slot : slots)
+        sorted[start[recs[slot].mat_id]++] = slot;
+}
+
+inline uint32_t ray_octant(const ray& r) {
+    // Which of the eight direction octants the ray points into, by the signs traversal uses
+    // to pick the near child of a box, x in the high bit.
+    return (r.dir_is_neg(0) ? 4u : 0u) | (r.dir_is_neg(1) ? 2u : 0u) | (r.dir_is_neg(2) ? 1u : 0u);
+}
+
+inline void sort_by_octant(
+    std::vector<uint32_t>::iterator first, std::vector<uint32_t>::iterator last,
+    const std::vector<ray>& rays, std::vector<uint32_t>& scratch
+) {
+    // Counting sort of the indices of [first, last) by the octant of their rays, keeping the
+    // order of indices that share an octant. Rays in one octant cross every box from the same
+    // side, so they descend the BVH in the same child order.
+    uint32_t start[9] = {};
+    for (auto it = first; it != last; ++it)
+        start[ray_octant(rays[*it]) + 1]++;
+    for (int octant = 1; octant < 9; octant++)
+        start[octant] += start[octant - 1];
+
+    scratch.resize(size_t(last - first));
+    for (auto it = first; it != last; ++it)
+        scratch[start[ray_octant(rays[*it])]++] = *it;
+
+    std::copy(scratch.begin(), scratch.end(), first);
+}
+
+inline uint32_t spread_bits_3(uint32_t x) {
+    // Moves the low 9 bits of x to every third bit, for interleaving into a Morton code.
+    x &= 0x1ff;
+    x = (x | (x << 16)) & 0x030000ff;
+    x = (x | (x <<  8)) & 0x0300f00f;
+    x = (x | (x <<  4)) & 0x030c30c3;
+    x = (x | (x <<  2)) & 0x09249249;
+    return x;
+}
+
+inline uint32_t ray_bin(const ray& r, const aabb& bounds) {
+    // 30-bit sort key of a ray: the octant of its direction in the top 3 bits, then a 27-bit
+    // Morton code of its origin within bounds. Rays with close keys point the same way from
+    // nearby points, so they tend to visit the same BVH nodes.
+    uint32_t morton = 0;
+    for (int axis = 0; axis < 3; axis++) {
+        const auto& extent = bounds.axis_interval(axis);
+        auto offset = (r.origin()[axis] - extent.min) / extent.size();
+        auto cell = offset > 0 ? uint32_t(std::fmin(offset, 1.0) * 511) : 0u;
+        morton |= spread_bits_3(cell) << (2 - axis);
+    }
+
+    return (ray_octant(r) << 27) | morton;
+}
+
+inline void sort_by_ray_bin(
+    std::vector<uint32_t>::iterator first, std::vector<uint32_t>::iterator last,
+    const std::vector<ray>& rays, const aabb& bounds, std::vector<uint64_t>& keys
+) {
+    // Reorders the slots of [first, last) by the ray_bin of their rays. Each slot is packed
+    // below its key, so the sort compares plain integers and ties keep slot order.
+    keys.clear();
+    for (auto it = first; it != last; ++it)
+        keys.push_back((uint64_t(ray_bin(rays[*it], bounds)) << 32) | *it);
+
+    std::sort(keys.begin(), keys.end());
+
+    for (auto key : keys)
+        *first++ = uint32_t(key);
+}
+
+#endif
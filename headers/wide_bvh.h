@@ -0,0 +1,337 @@
+#ifndef WIDE_BVH_H
+#define WIDE_BVH_H
+
+#include "linear_bvh.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#if defined(__SSE__) || defined(_M_X64)
+    #include <immintrin.h>
+#endif
+
+// Wide slab tests scale each box exit distance by 1 + 2*gamma(3) to absorb the rounding of the
+// float slab arithmetic. Rounding the ray origin to float is an absolute error instead, so each
+// axis also widens its slab interval at both ends by a per-ray pad (see wide_bvh::traverse).
+const float wide_box_robust_scale = 1.0000004f;
+
+template <int N>
+class alignas(32) wide_bvh_node {
+  // A node with up to N children whose boxes are stored as structure-of-arrays float lanes,
+  // so all child boxes can be slab-tested with one set of vector instructions.
+  public:
+    float min_x[N], min_y[N], min_z[N];
+    float max_x[N], max_y[N], max_z[N];
+    uint32_t child[N];       // Interior child: node index. Leaf child: first primitive slot.
+    uint8_t  prim_count[N];  // Primitives in a leaf child, 0 for an interior child
+    uint8_t  child_count;    // Children in use, stored in lanes [0, child_count)
+};
+
+template <int N>
+class wide_box_test {
+  // Slab test of one ray against the N child boxes of a node. Writes each lane's entry
+  // distance to t_near and returns a bit mask of the lanes whose box the ray enters within
+  // [t_min, t_max]. Each axis's slab distances are widened by pad[axis] at both ends. Lanes at
+  // or beyond child_count must be masked off by the caller.
+  public:
+    static unsigned test(const wide_bvh_node<N>& node, const float orig[3], const float inv_dir[3],
+                         const float pad[3], float t_min, float t_max, float t_near[N]) {
+        unsigned mask = 0;
+        const float* mins[3] = { node.min_x, node.min_y, node.min_z };
+        const float* maxs[3] = { node.max_x, node.max_y, node.max_z };
+
+        for (int lane = 0; lane < N; lane++) {
+            float lo = t_min, hi = t_max;
+            for (int axis = 0; axis < 3; axis++) {
+                float t0 = (mins[axis][lane] - orig[axis]) * inv_dir[axis];
+                float t1 = (maxs[axis][lane] - orig[axis]) * inv_dir[axis];
+                if (t0 > t1) std::swap(t0, t1);
+                t0 -= pad[axis];
+                lo = t0 > lo ? t0 : lo;
+                t1 = (t1 + pad[axis]) * wide_box_robust_scale;
+                hi = t1 < hi ? t1 : hi;
+            }
+            t_near[lane] = lo;
+            if (lo <= hi)
+                mask |= 1u << lane;
+        }
+        return mask;
+    }
+};
+
+#if defined(__SSE__) || defined(_M_X64)
+template <>
+class wide_box_test<4> {
+  public:
+    static unsigned test(const wide_bvh_node<4>& node, const float orig[3], const float inv_dir[3],
+                         const float pad[3], float t_min, float t_max, float t_near[4]) {
+        // Min and max are ordered so that a NaN slab distance (0 * inf, a ray lying in a slab
+        // plane) leaves the running interval unchanged.
+        __m128 lo = _mm_set1_ps(t_min);
+        __m128 hi = _mm_set1_ps(t_max);
+
+        const float* mins[3] = { node.min_x, node.min_y, node.min_z };
+        const float* maxs[3] = { node.max_x, node.max_y, node.max_z };
+
+        for (int axis = 0; axis < 3; axis++) {
+            __m128 o   = _mm_set1_ps(orig[axis]);
+            __m128 inv = _mm_set1_ps(inv_dir[axis]);
+            __m128 p   = _mm_set1_ps(pad[axis]);
+            __m128 t0 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(mins[axis]), o), inv);
+            __m128 t1 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(maxs[axis]), o), inv);
+            lo = _mm_max_ps(_mm_sub_ps(_mm_min_ps(t0, t1), p), lo);
+            hi = _mm_min_ps(_mm_mul_ps(_mm_add_ps(_mm_max_ps(t0, t1), p), _mm_set1_ps(wide_box_robust_scale)), hi);
+        }
+
+        _mm_storeu_ps(t_near, lo);
+        return unsigned(_mm_movemask_ps(_mm_cmple_ps(lo, hi)));
+    }
+};
+#endif
+
+#if defined(__AVX2__)
+template <>
+class wide_box_test<8> {
+  public:
+    static unsigned test(const wide_bvh_node<8>& node, const float orig[3], const float inv_dir[3],
+                         const float pad[3], float t_min, float t_max, float t_near[8]) {
+        __m256 lo = _mm256_set1_ps(t_min);
+        __m256 hi = _mm256_set1_ps(t_max);
+
+        const float* mins[3] = { node.min_x, node.min_y, node.min_z };
+        const float* maxs[3] = { node.max_x, node.max_y, node.max_z };
+
+        for (int axis = 0; axis < 3; axis++) {
+            __m256 o   = _mm256_set1_ps(orig[axis]);
+            __m256 inv = _mm256_set1_ps(inv_dir[axis]);
+            __m256 p   = _mm256_set1_ps(pad[axis]);
+            __m256 t0 = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(mins[axis]), o), inv);
+            __m256 t1 = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(maxs[axis]), o), inv);
+            lo = _mm256_max_ps(_mm256_sub_ps(_mm256_min_ps(t0, t1), p), lo);
+            hi = _mm256_min_ps(_mm256_mul_ps(_mm256_add_ps(_mm256_max_ps(t0, t1), p), _mm256_set1_ps(wide_box_robust_scale)), hi);
+        }
+
+        _mm256_storeu_ps(t_near, lo);
+        return unsigned(_mm256_movemask_ps(_mm256_cmp_ps(lo, hi, _CMP_LE_OQ)));
+    }
+};
+#endif
+
+template <int N>
+class wide_bvh : public hittable {
+  // An N-ary BVH collapsed from the binary flat_bvh: each wide node adopts the grandchildren
+  // of its largest interior children until it has N children, which cuts the number of node
+  // fetches per ray roughly by log2(N).
+  public:
+    wide_bvh(const hittable_list& list, int max_leaf_size = 4) {
+        // Leaf sizes are capped to fit the nodes' 8-bit prim_count lanes.
+        max_leaf_size = std::clamp(max_leaf_size, 1, int(std::numeric_limits<uint8_t>::max()));
+
+        std::vector<aabb> bounds;
+        bounds.reserve(list.objects.size());
+        for (const auto& object : list.objects)
+            bounds.push_back(object->bounding_box());
+
+        flat_bvh binary;
+        binary.build(bounds, max_leaf_size);
+
+        objects.reserve(list.objects.size());
+        for (auto index : binary.prim_order)
+            objects.push_back(list.objects[index]);
+
+        if (!binary.nodes.empty())
+            collapse(binary, 0);
+
+        bbox = list.bounding_box();
+    }
+
+    bool intersect(const ray& r, interval ray_t, hit_record& rec) const override {
+        return traverse<false>(r, ray_t, [&](uint32_t slot, interval& t) {
+            if (!objects[slot]->intersect(r, t, rec))
+                return false;
+            t.max = rec.t;
+            return true;
+        });
+    }
+
+    bool occluded(const ray& r, interval ray_t) const override {
+        return traverse<true>(r, ray_t, [&](uint32_t slot, interval& t) {
+            return objects[slot]->occluded(r, t);
+        });
+    }
+
+    aabb bounding_box() const override { return bbox; }
+
+    void gather_emitters(const shared_ptr<hittable>&, std::vector<emitter>& lights)
+    const override {
+        for (const auto& object : objects)
+            object->gather_emitters(object, lights);
+    }
+
+    size_t node_count() const { return nodes.size(); }
+
+  private:
+    class stack_entry {
+      public:
+        float t_near;
+        uint32_t index;
+        uint32_t prim_count;
+    };
+
+    // The binary tree is at most 64 levels deep, and each wide level pushes at most N entries.
+    static constexpr int stack_capacity = 64 * N;
+
+    std::vector<wide_bvh_node<N>> nodes;
+    std::vector<shared_ptr<hittable>> objects;  // In leaf slot order
+    aabb bbox;
+
+    template <bool any_hit, typename LeafHit>
+    bool traverse(const ray& r, interval ray_t, LeafHit&& hit_slot) const {
+        // Same contract as flat_bvh::traverse: hit_slot(slot, ray_t) shrinks ray_t.max on a
+        // hit, and with any_hit set the walk stops at the first hit.
+        if (nodes.empty())
+            return false;
+
+        const float orig[3] = { float(r.origin().x()), float(r.origin().y()), float(r.origin().z()) };
+        const float inv_dir[3] = {
+            float(r.inv_direction().x()), float(r.inv_direction().y()), float(r.inv_direction().z())
+        };
+
+        // Rounding the origin to float moves every slab distance on an axis by up to the
+        // rounding error times |inv_dir|, toward either end. Axes the ray runs parallel to need
+        // no pad: rounding never carries the origin across a float slab plane.
+        float pad[3];
+        for (int axis = 0; axis < 3; axis++) {
+            auto error = std::abs(double(orig[axis]) - r.origin()[axis]);
+            auto inv = std::abs(r.inv_direction()[axis]);
+            pad[axis] = (error > 0 && std::isfinite(inv))
+                      ? float(error * inv) * wide_box_robust_scale : 0.0f;
+        }
+
+        // Every stack entry is either a node or a leaf's primitive range, with the distance at
+        // which the ray enters its box. Entries farther than the closest hit are skipped.
+        stack_entry stack[stack_capacity];
+        int stack_size = 0;
+        stack[stack_size++] = stack_entry{ float(ray_t.min), 0, 0 };
+
+        bool hit_anything = false;
+
+        while (stack_size > 0) {
+            auto entry = stack[--stack_size];
+            if (entry.t_near > ray_t.max)
+                continue;
+
+            if (entry.prim_count > 0) {
+                for (uint32_t slot = entry.index; slot < entry.index + entry.prim_count; slot++) {
+                    if (hit_slot(slot, ray_t)) {
+                        if (any_hit)
+                            return true;
+                        hit_anything = true;
+                    }
+                }
+                continue;
+            }
+
+            const auto& node = nodes[entry.index];
+            record_node_visit(&node);
+            alignas(32) float t_near[N];
+            unsigned mask = wide_box_test<N>::test(
+                node, orig, inv_dir, pad, float(ray_t.min), float(ray_t.max), t_near);
+            mask &= (1u << node.child_count) - 1;
+
+            // Push the children that were hit, farthest first, so the nearest is popped next.
+            int first = stack_size;
+            for (int lane = 0; lane < N; lane++) {
+                if (mask & (1u << lane))
+                    stack[stack_size++] = stack_entry{ t_near[lane], node.child[lane], node.prim_count[lane] };
+            }
+            std::sort(stack + first, stack + stack_size, [](const stack_entry& a, const stack_entry& b) {
+                return a.t_near > b.t_near;
+            });
+        }
+
+        return hit_anything;
+    }
+
+    static float surface_area(const linear_bvh_node& node) {
+        auto dx = node.bounds_max[0] - node.bounds_min[0];
+        auto dy = node.bounds_max[1] - node.bounds_min[1];
+        auto dz = node.bounds_max[2] - node.bounds_min[2];
+        return 2 * (dx*dy + dy*dz + dz*dx);
+    }
+
+    uint32_t collapse(const flat_bvh& binary, uint32_t root) {
+        // Creates the wide node standing for binary node root, and recursively its subtrees.
+
+        uint32_t children[N];
+        int count = 0;
+
+        const auto& root_node = binary.nodes[root];
+        if (root_node.is_leaf()) {
+            children[count++] = root;
+        } else {
+            children[count++] = root + 1;
+            children[count++] = root_node.offset;
+        }
+
+        // Open up the interior child with the largest surface area until the node is full.
+        while (count < N) {
+            int best = -1;
+            float best_area = -1;
+            for (int i = 0; i < count; i++) {
+                const auto& child = binary.nodes[children[i]];
+                if (!child.is_leaf() && surface_area(child) > best_area) {
+                    best = i;
+                    best_area = surface_area(child);
+                }
+            }
+            if (best < 0)
+                break;
+
+            auto opened = children[best];
+            children[best] = opened + 1;
+            children[count++] = binary.nodes[opened].offset;
+        }
+
+        auto node_index = uint32_t(nodes.size());
+        nodes.emplace_back();
+        {
+            auto& node = nodes[node_index];
+            for (int lane = 0; lane < N; lane++) {
+                node.min_x[lane] = node.min_y[lane] = node.min_z[lane] = +infinity;
+                node.max_x[lane] = node.max_y[lane] = node.max_z[lane] = -infinity;
+                node.child[lane] = 0;
+                node.prim_count[lane] = 0;
+            }
+            node.child_count = uint8_t(count);
+        }
+
+        for (int lane = 0; lane < count; lane++) {
+            const auto& child = binary.nodes[children[lane]];
+
+            uint32_t child_index = child.is_leaf() ? child.offset : collapse(binary, children[lane]);
+
+            auto& node = nodes[node_index];  // collapse() may have reallocated the array
+            node.min_x[lane] = child.bounds_min[0];
+            node.min_y[lane] = child.bounds_min[1];
+            node.min_z[lane] = child.bounds_min[2];
+            node.max_x[lane] = child.bounds_max[0];
+            node.max_y[lane] = child.bounds_max[1];
+            node.max_z[lane] = child.bounds_max[2];
+            node.child[lane] = child_index;
+            node.prim_count[lane] = uint8_t(child.prim_count);
+        }
+
+        return node_index;
+    }
+};
+
+// BVH4 tests its child boxes with SSE. BVH8 uses AVX when compiled with AVX2 support, and
+// otherwise falls back to the scalar test.
+using bvh4 = wide_bvh<4>;
+using bvh8 = wide_bvh<8>;
+
+#endif
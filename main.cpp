@@ -1,12 +1,15 @@
 #include "headers/rtweekend.h"
 
+#include "headers/bvh.h"
 #include "headers/camera.h"
 #include "headers/hittable_list.h"
+#include "headers/light_sampler.h"
 #include "headers/material.h"
 #include "headers/quad.h"
+#include "headers/render_options.h"
 #include "headers/sphere.h"
 
-void cornell_box(int image_width, int samples_per_pixel, int max_depth, const std::string& output_file = "", const std::string& denoise_mode = "") {
+void cornell_box(int image_width, int samples_per_pixel, int max_depth, const render_options& options = {}) {
     hittable_list world;
 
     auto red   = make_shared<lambertian>(color(.65, .05, .05));
@@ -34,13 +37,8 @@ void cornell_box(int image_width, int samples_per_pixel, int max_depth, const st
     auto glass = make_shared<dielectric>(1.5);
     world.add(make_shared<sphere>(point3(190,90,190), 90, glass));
 
-    // Light Sources for importance sampling
-    auto empty_material = shared_ptr<material>();
-    hittable_list lights;
-    lights.add(
-        make_shared<quad>(point3(343,554,332), vec3(-130,0,0), vec3(0,0,-105), empty_material));
-    // Add sphere for better ray distribution in importance sampling
-    lights.add(make_shared<sphere>(point3(190, 90, 190), 90, empty_material));
+    // Light sources for importance sampling, collected from the world
+    auto lights = gather_lights(world);
 
     camera cam;
 
@@ -56,29 +54,131 @@ void cornell_box(int image_width, int samples_per_pixel, int max_depth, const st
     cam.vup      = vec3(0, 1, 0);
 
     cam.defocus_angle = 0;
-    
-    if (!denoise_mode.empty()) {
-        cam.denoise = true;
-        cam.denoise_mode = denoise_mode;
+
+    options.apply(cam);
+
+    if (options.ray_benchmark) {
+        cam.measure_camera_rays(world);
+        return;
     }
 
-    cam.render_to_file(output_file, world, lights);
+    cam.render_to_file(options.output_file, world, *lights);
+}
+
+void box_benchmark() {
+    // Times one ray-box slab test both ways: as aabb::hit used to do it, taking three
+    // reciprocals and branching on their order for every box, and as aabb::hit does now, with
+    // the ray's cached reciprocals and min/max selects. The boxes are the outer loop, so the
+    // old test can't hoist a ray's reciprocals out of the box loop as a BVH walk can't.
+    const int box_count = 1024;
+    const int ray_count = 1024;
+    const int repeats = 20;
+
+    std::vector<aabb> boxes;
+    for (int b = 0; b < box_count; b++) {
+        auto center = point3::random(-10, 10);
+        auto half = vec3::random(0.05, 1);
+        boxes.push_back(aabb(center - half, center + half));
+    }
+
+    std::vector<ray> rays;
+    for (int k = 0; k < ray_count; k++)
+        rays.push_back(ray(point3::random(-12, 12), random_unit_vector()));
+
+    auto per_box_reciprocal = [](const aabb& box, const ray& r, interval ray_t) {
+        for (int axis = 0; axis < 3; axis++) {
+            const interval& ax = box.axis_interval(axis);
+            const double adinv = 1.0 / r.direction()[axis];
+
+            auto t0 = (ax.min - r.origin()[axis]) * adinv;
+            auto t1 = (ax.max - r.origin()[axis]) * adinv;
+
+            if (t0 < t1) {
+                if (t0 > ray_t.min) ray_t.min = t0;
+                if (t1 < ray_t.max) ray_t.max = t1;
+            } else {
+                if (t1 > ray_t.min) ray_t.min = t1;
+                if (t0 < ray_t.max) ray_t.max = t0;
+            }
+
+            if (ray_t.max <= ray_t.min)
+                return false;
+        }
+        return true;
+    };
+
+    auto time_tests = [&](auto&& box_hit, const char* name) {
+        long hits = 0;
+        auto start = std::chrono::steady_clock::now();
+        for (int rep = 0; rep < repeats; rep++) {
+            for (const auto& box : boxes) {
+                for (const auto& r : rays)
+                    hits += box_hit(box, r, interval(0.001, infinity));
+            }
+        }
+        auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        auto ns = 1e9 * seconds / (double(repeats) * box_count * ray_count);
+        std::clog << name << ": " << ns << " ns per box, " << hits / repeats << " hits\n";
+        return ns;
+    };
+
+    auto old_ns = time_tests(per_box_reciprocal, "Reciprocal per box");
+    auto new_ns = time_tests([](const aabb& box, const ray& r, interval ray_t) {
+        return box.hit(r, ray_t);
+    }, "Cached reciprocal ");
+    std::clog << "Speedup: " << old_ns / new_ns << "x\n";
+}
+
+void bvh_benchmark() {
+    // Times bvh_node builds over a cloud of small spheres, on one thread and on every hardware
+    // thread, for both split methods. The SAH cost of each tree is logged alongside, since a
+    // parallel build must produce the same tree as a serial one.
+    const int sphere_count = 200000;
+
+    hittable_list spheres;
+    auto white = make_shared<lambertian>(color(.73, .73, .73));
+    for (int k = 0; k < sphere_count; k++)
+        spheres.add(make_shared<sphere>(point3::random(0, 100), random_double(0.05, 0.5), white));
+
+    std::vector<int> thread_counts{1};
+    if (tile_scheduler::default_thread_count() > 1)
+        thread_counts.push_back(tile_scheduler::default_thread_count());
+
+    for (auto split : {bvh_split::median, bvh_split::sah}) {
+        for (auto n : thread_counts) {
+            bvh_node tree(spheres, split, n);
+            std::clog << (split == bvh_split::sah ? "SAH   " : "Median") << " build, "
+                      << n << " thread" << (n == 1 ? ": " : "s: ") << 1000 * tree.build_time()
+                      << " ms, SAH cost " << tree.sah_cost() << "\n";
+        }
+    }
 }
 
 void print_usage(const char* program_name) {
-    std::cerr << "Usage: " << program_name << " [quality] [output_file.png] [--denoise MODE]\n"
+    std::cerr << "Usage: " << program_name << " [quality] [output_file.png] [--denoise MODE] [--integrator MODE]\n"
+              << "       [--adaptive THRESHOLD] [--sample-budget SPP] [--heatmap heatmap.png]\n"
+              << "       [--time-budget SECONDS] [--snapshot SECONDS]\n"
+              << "       [--checkpoint FILE] [--checkpoint-interval SECONDS]\n"
+              << "       [--packets] [--ray-benchmark] [--wavefront] [--sort-rays] [--ray-stats]\n"
+              << "       [--box-benchmark] [--bvh-benchmark]\n"
               << "Quality presets: draft, low, medium, high, ultra (default=medium)\n"
               << "  draft:  400x400, 50 samples, depth 8\n"
               << "  low:    800x800, 150 samples, depth 20\n"
               << "  medium: 1200x1200, 500 samples, depth 50\n"
               << "  high:   1920x1920, 1000 samples, depth 80\n"
               << "  ultra:  2560x2560, 4000 samples, depth 200\n"
-              << "Output file: PNG filename (optional, outputs PPM to stdout if omitted)\n"
-              << "Denoising: --denoise bilateral|median|fast (optional, post-processes final image)\n"
+              << "Output file: PNG filename (optional, outputs PPM to stdout if omitted)\n";
+    render_options::print_usage(std::cerr);
+    std::cerr << "Box benchmark: --box-benchmark times the ray-box slab test alone and exits\n"
+              << "BVH benchmark: --bvh-benchmark times BVH builds on 1 and all threads and exits\n"
               << "Examples:\n"
               << "  " << program_name << " high cornell.png\n"
               << "  " << program_name << " medium cornell.png --denoise bilateral\n"
-              << "  " << program_name << " draft --denoise fast\n";
+              << "  " << program_name << " draft --denoise fast\n"
+              << "  " << program_name << " low cornell.png --integrator nee\n"
+              << "  " << program_name << " medium cornell.png --adaptive 0.02 --heatmap spp.png\n"
+              << "  " << program_name << " ultra cornell.png --time-budget 600 --snapshot 30\n"
+              << "  " << program_name << " ultra cornell.png --checkpoint cornell.ckpt\n";
 }
 
 void get_quality_settings(const std::string& quality, int& width, int& samples, int& depth) {
@@ -100,8 +200,9 @@ int main(int argc, char* argv[]) {
     int samples = 250;
     int depth = 30;
     std::string quality = "medium";
-    std::string output_file;
-    std::string denoise_mode;
+    render_options options;
+    bool box_bench = false;
+    bool bvh_bench = false;
 
     if (argc > 1) {
         if (std::string(argv[1]) == "-h" || std::string(argv[1]) == "--help") {
@@ -111,25 +212,35 @@ int main(int argc, char* argv[]) {
         quality = argv[1];
         get_quality_settings(quality, width, samples, depth);
     }
-    if (argc > 2) output_file = argv[2];
+    if (argc > 2) options.output_file = argv[2];
     
     // Parse denoising option
     for (int i = 3; i < argc; ++i) {
         std::string arg = argv[i];
-        if (arg == "--denoise" && i + 1 < argc) {
-            denoise_mode = argv[++i];
+        if (arg == "--box-benchmark") {
+            box_bench = true;
+        } else if (arg == "--bvh-benchmark") {
+            bvh_bench = true;
+        } else {
+            options.parse(argc, argv, i);
         }
     }
 
-    std::cerr << "Cornell Box [" << quality << "] (" << width << "x" << width 
-              << ", " << samples << " samples, depth " << depth << ")\n";
-    if (!output_file.empty()) {
-        std::cerr << "Output: " << output_file << "\n";
+    if (box_bench) {
+        box_benchmark();
+        return 0;
     }
-    if (!denoise_mode.empty()) {
-        std::cerr << "Denoising: " << denoise_mode << "\n";
+
+    if (bvh_bench) {
+        bvh_benchmark();
+        return 0;
     }
 
-    cornell_box(width, samples, depth, output_file, denoise_mode);
+    std::cerr << "Cornell Box [" << quality << "] (" << width << "x" << width 
+              << ", " << samples << " samples, depth " << depth << ", "
+              << (sizeof(real) == sizeof(float) ? "float" : "double") << " precision)\n";
+    options.print_summary(std::cerr);
+
+    cornell_box(width, samples, depth, options);
     return 0;
 }
\ No newline at end of file
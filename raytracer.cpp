@@ -5,16 +5,18 @@
 #include "headers/constant_medium.h"
 #include "headers/hittable.h"
 #include "headers/hittable_list.h"
+#include "headers/light_sampler.h"
 #include "headers/material.h"
 #include "headers/quad.h"
+#include "headers/render_options.h"
 #include "headers/sphere.h"
 #include "headers/texture.h"
 
 // Forward declarations
-void simple_scene(int image_width, int samples_per_pixel, int max_depth, const std::string& output_file = "", const std::string& denoise_mode = "");
-void final_scene(int image_width, int samples_per_pixel, int max_depth, const std::string& output_file = "", const std::string& denoise_mode = "");
+void simple_scene(int image_width, int samples_per_pixel, int max_depth, const render_options& options = {});
+void final_scene(int image_width, int samples_per_pixel, int max_depth, const render_options& options = {});
 
-void simple_scene(int image_width, int samples_per_pixel, int max_depth, const std::string& output_file, const std::string& denoise_mode) {
+void simple_scene(int image_width, int samples_per_pixel, int max_depth, const render_options& options) {
     hittable_list world;
     auto ground = make_shared<lambertian>(color(0.5, 0.5, 0.5));
     world.add(make_shared<sphere>(point3(0, -1000, 0), 1000, ground));
@@ -66,16 +68,18 @@ void simple_scene(int image_width, int samples_per_pixel, int max_depth, const s
 
     cam.defocus_angle = 0.6;
     cam.focus_dist    = 10.0;
-    
-    if (!denoise_mode.empty()) {
-        cam.denoise = true;
-        cam.denoise_mode = denoise_mode;
+
+    options.apply(cam);
+
+    if (options.ray_benchmark) {
+        cam.measure_camera_rays(world);
+        return;
     }
 
-    cam.render_to_file(output_file, world, lights);
+    cam.render_to_file(options.output_file, world, lights);
 }
 
-void final_scene(int image_width, int samples_per_pixel, int max_depth, const std::string& output_file, const std::string& denoise_mode) {
+void final_scene(int image_width, int samples_per_pixel, int max_depth, const render_options& options) {
     hittable_list boxes1;
     auto ground = make_shared<lambertian>(color(0.48, 0.83, 0.53));
 
@@ -95,7 +99,9 @@ void final_scene(int image_width, int samples_per_pixel, int max_depth, const st
     }
 
     hittable_list world;
-    world.add(make_shared<bvh_node>(boxes1));
+    auto box_field = make_shared<bvh_node>(boxes1, bvh_split::sah);
+    std::clog << "BVH build: " << 1000 * box_field->build_time() << " ms\n";
+    world.add(box_field);
 
     // Main light
     auto light = make_shared<diffuse_light>(color(7, 7, 7));
@@ -139,15 +145,13 @@ void final_scene(int image_width, int samples_per_pixel, int max_depth, const st
     }
     world.add(make_shared<translate>(
         make_shared<rotate_y>(
-            make_shared<bvh_node>(boxes2), 15),
+            make_shared<bvh_node>(boxes2, bvh_split::sah), 15),
             vec3(-100,270,395)
         )
     );
 
-    // Lights list (for importance sampling)
-    auto empty_material = shared_ptr<material>();
-    hittable_list lights;
-    lights.add(make_shared<quad>(point3(123,554,147), vec3(300,0,0), vec3(0,0,265), empty_material));
+    // Light sources for importance sampling, collected from the world
+    auto lights = gather_lights(world);
 
     camera cam;
     cam.aspect_ratio      = 1.0;
@@ -162,17 +166,23 @@ void final_scene(int image_width, int samples_per_pixel, int max_depth, const st
     cam.vup      = vec3(0,1,0);
 
     cam.defocus_angle = 0;
-    
-    if (!denoise_mode.empty()) {
-        cam.denoise = true;
-        cam.denoise_mode = denoise_mode;
+
+    options.apply(cam);
+
+    if (options.ray_benchmark) {
+        cam.measure_camera_rays(world);
+        return;
     }
 
-    cam.render_to_file(output_file, world, lights);
+    cam.render_to_file(options.output_file, world, *lights);
 }
 
 void print_usage(const char* program_name) {
-    std::cerr << "Usage: " << program_name << " [scene] [quality] [output_file.png] [--denoise MODE]\n"
+    std::cerr << "Usage: " << program_name << " [scene] [quality] [output_file.png] [--denoise MODE] [--integrator MODE]\n"
+              << "       [--adaptive THRESHOLD] [--sample-budget SPP] [--heatmap heatmap.png]\n"
+              << "       [--time-budget SECONDS] [--snapshot SECONDS]\n"
+              << "       [--checkpoint FILE] [--checkpoint-interval SECONDS]\n"
+              << "       [--packets] [--ray-benchmark] [--wavefront] [--sort-rays] [--ray-stats]\n"
               << "Scenes: 1=simple, 2=final (default=2)\n"
               << "Quality presets: draft, low, medium, high, ultra (default=medium)\n"
               << "  draft:  400x400, 10 samples, depth 2 (instant preview)\n"
@@ -180,9 +190,9 @@ void print_usage(const char* program_name) {
               << "  medium: 1200x1200, 250 samples, depth 30 (2-3 min)\n"
               << "  high:   1920x1920, 500 samples, depth 50 (5-10 min)\n"
               << "  ultra:  2560x2560, 2000 samples, depth 100 (30+ min)\n"
-              << "Output file: PNG filename (optional, outputs PPM to stdout if omitted)\n"
-              << "Denoising: --denoise bilateral|median|fast (optional, post-processes final image)\n"
-              << "Examples:\n"
+              << "Output file: PNG filename (optional, outputs PPM to stdout if omitted)\n";
+    render_options::print_usage(std::cerr);
+    std::cerr << "Examples:\n"
               << "  " << program_name << " 1 high output.png\n"
               << "  " << program_name << " 2 medium final.png --denoise bilateral\n"
               << "  " << program_name << " 1 draft --denoise fast\n";
@@ -208,8 +218,7 @@ int main(int argc, char* argv[]) {
     int samples = 250;
     int depth = 30;
     std::string quality = "medium";
-    std::string output_file;
-    std::string denoise_mode;
+    render_options options;
 
     if (argc > 1) {
         if (std::string(argv[1]) == "-h" || std::string(argv[1]) == "--help") {
@@ -222,28 +231,20 @@ int main(int argc, char* argv[]) {
         quality = argv[2];
         get_quality_settings(quality, width, samples, depth);
     }
-    if (argc > 3) output_file = argv[3];
+    if (argc > 3) options.output_file = argv[3];
     
     // Parse denoising option
     for (int i = 4; i < argc; ++i) {
-        std::string arg = argv[i];
-        if (arg == "--denoise" && i + 1 < argc) {
-            denoise_mode = argv[++i];
-        }
+        options.parse(argc, argv, i);
     }
 
     std::cerr << "Scene " << scene << " [" << quality << "] (" << width << "x" << width 
               << ", " << samples << " samples, depth " << depth << ")\n";
-    if (!output_file.empty()) {
-        std::cerr << "Output: " << output_file << "\n";
-    }
-    if (!denoise_mode.empty()) {
-        std::cerr << "Denoising: " << denoise_mode << "\n";
-    }
+    options.print_summary(std::cerr);
 
     switch (scene) {
-        case 1:  simple_scene(width, samples, depth, output_file, denoise_mode); break;
-        case 2:  final_scene(width, samples, depth, output_file, denoise_mode); break;
+        case 1:  simple_scene(width, samples, depth, options); break;
+        case 2:  final_scene(width, samples, depth, options); break;
         default: 
             std::cerr << "Unknown scene: " << scene << "\n";
             print_usage(argv[0]);